@@ -12,12 +12,16 @@
 
 #include <sys/time.h>
 #include <time.h>
+#include <pthread.h>
 #include "slist.h"
+#include "slab.h"
+#include "pool.h"
 #include "mla.h"
 
 #define mla_list_init                slist_init
 #define mla_slist_foreach            slist_foreach
 #define mla_list_add                 slist_add
+#define mla_list_add_head            slist_add_head
 #define mla_list_add_tail            slist_add_tail
 #define mla_list_next_get            slist_next_get
 #define mla_list_prev_get            slist_prev_get
@@ -25,10 +29,31 @@
 #define mla_list_node_count_get      slist_node_count_get
 typedef slist_node_t    mla_list_node_t;
 
+#define mla_slab_init                slab_init
+#define mla_slab_release             slab_release
+#define mla_slab_alloc               slab_alloc
+#define mla_slab_free                slab_free
+#define mla_slab_reserved_get        slab_reserved_get
+#define mla_slab_used_get            slab_used_get
+typedef slab_t    mla_slab_t;
+
+#define mla_atomic_load(p)           __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define mla_atomic_store(p, v)       __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define mla_atomic_set(p, v)         __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define mla_atomic_add(p, v)         __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+#define mla_atomic_cas(p, e, v)      __atomic_compare_exchange_n(p, e, v, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define mla_atomic_xchg(p, v)        __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL)
+#define mla_lock_init(l)             pthread_mutex_init(l, NULL)
+#define mla_lock(l)                  pthread_mutex_lock(l)
+#define mla_unlock(l)                pthread_mutex_unlock(l)
+typedef pthread_mutex_t    mla_lock_t;
+
 // V: view, VO: only view
 enum {LOG_LEVEL, V, D, I, W, E, NO, VO, DO, IO, WO, EO};
 
+#ifndef FILTER
 #define FILTER    V  // log filtering level (exclude oneself)
+#endif
 #define LOGV(...)    LOG(V, __VA_ARGS__)
 #define LOGD(...)    LOG(D, __VA_ARGS__)
 #define LOGI(...)    LOG(I, __VA_ARGS__)
@@ -39,9 +64,51 @@ enum {LOG_LEVEL, V, D, I, W, E, NO, VO, DO, IO, WO, EO};
 #define TAG    "TAG"  // default tag
 #define LOG_BUFFER_SIZE    (256)
 #define LOG_HZ    (0)  // 0: not care, >1: max number of ouput per second
+#ifndef CFG_LOG_BINARY
+#define CFG_LOG_BINARY    0  // 1: store the format id and raw arguments, render the log with tools/log_decode.c
+#endif
+
+/* static per call site, lines beyond LOG_HZ are dropped and counted */
+typedef struct log_throttle {
+    const char *file;
+    uint32_t line;
+    uint32_t dropped;  // since the last report
+    uint32_t first_ms;  // time of day of the first of them
+    uint8_t listed;
+    uint64_t tat;  // token bucket kept as the time in us its next token is due
+    struct log_throttle *next;  // sites that ever dropped, log_deinit reports what is left
+} log_throttle_t;
+
+/* static per call site, the format string is kept by pointer and sent to the log once */
+typedef struct {
+    const char *level;
+    const char *tag;
+    const char *file;
+    uint32_t line;
+    const char *format;
+    uint32_t id;  // 0 until the first call
+    uint32_t epoch;  // log_init count when the dictionary record was written
+} log_site_t;
 
 // Level - Date Time - {Tag} - <func: line> - message
 // E>09/16 11:17:33.990 {TEST-sku} <test: 373> This is test.
+#if CFG_LOG_BINARY
+#define LOG(level, ...) \
+    do { \
+        if (level + NO == FILTER) { \
+        } else if (level < FILTER) { \
+            break; \
+        } \
+        char tag[] = TAG; \
+        if (log_control(tag)) break; \
+        bool jump = false; \
+        static log_throttle_t log_throttle = {__FILE__, __LINE__}; \
+        level == V ? : LOG_HZ == 0 ? : (jump = log_throttling(&log_throttle, LOG_HZ)); \
+        if (jump) break; \
+        static log_site_t log_site = {#level, TAG, __FILE__, __LINE__, NULL, 0, 0}; \
+        log_binary(&log_site, __VA_ARGS__); \
+    } while(0)
+#else
 #define LOG(level, ...) \
     do { \
         if (level + NO == FILTER) { \
@@ -51,12 +118,14 @@ enum {LOG_LEVEL, V, D, I, W, E, NO, VO, DO, IO, WO, EO};
         char tag[] = TAG; \
         if (log_control(tag)) break; \
         bool jump = false; \
-        level == V ? : LOG_HZ == 0 ? : (jump = log_throttling(__FILENAME__, __LINE__, LOG_HZ)); \
+        static log_throttle_t log_throttle = {__FILE__, __LINE__}; \
+        level == V ? : LOG_HZ == 0 ? : (jump = log_throttling(&log_throttle, LOG_HZ)); \
         if (jump) break; \
         level == V ? : OUTPUT(#level">%s " "{%.8s} " "<%s: %u> ", get_current_time(NULL), tag, __FILENAME__, __LINE__); \
         OUTPUT(__VA_ARGS__); \
         level == V ? : OUTPUT("\r\n"); \
     } while(0)
+#endif
 
 #define __FILENAME__    (strrchr(__FILE__, '\\') ? (strrchr(__FILE__, '\\') + 1) : __FILE__)
 #define UNUSED(x)    (void)(x)
@@ -77,6 +146,7 @@ uint32_t BKDRHash(char *str);
 int log_init(void);
 int log_deinit(void);
 int log_out(const char *format, ...);
+int log_binary(log_site_t *site, const char *format, ...);
 char *get_current_time(uint32_t *today_ms);
-bool log_throttling(char *file, uint16_t line, uint8_t log_hz);
+bool log_throttling(log_throttle_t *site, uint8_t log_hz);
 bool log_control(char *tag);
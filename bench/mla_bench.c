@@ -0,0 +1,226 @@
+/**
+ * @file mla_bench.c
+ * @author skull (skull.gu@gmail.com)
+ * @brief benchmarks of the MLA and LOG hot paths, one result per line as CSV or JSON
+ * @version 0.1
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2023 skull
+ *
+ * $ ./do.sh bench            # CSV
+ * $ ./do.sh bench --json     # JSON, one object per line
+ * the build uses -DFILTER=I, so the LOGD calls inside MLA are compiled out of the measured paths;
+ * do.sh builds and runs it once per log backend and passes the enabled CFG_LOG_* / CFG_MLA_* switches as BENCH_CONFIG
+ */
+#include <pthread.h>
+#include "adapter.h"
+
+#define BENCH_ITER         (200000)  // operations per thread
+#define BENCH_LOG_ITER     (50000)
+#define BENCH_SITES_MAX    (4096)
+#define BENCH_THREADS_MAX  (8)
+#define BENCH_THROTTLE_MAX (32)
+#define BENCH_REPEAT       (3)  // the fastest run is reported
+#ifndef BENCH_CONFIG
+#define BENCH_CONFIG       "unknown"  // switches of the build, every row carries them
+#endif
+
+typedef struct {
+    const char *name;
+    uint32_t param;
+    uint32_t threads;
+} bench_case_t;
+
+typedef struct {
+    void (*fn)(uint32_t param);
+    uint32_t param;
+} bench_arg_t;
+
+static MlaSite_t sites[BENCH_SITES_MAX];
+static MlaSite_t free_site = {"mla_bench.c", "free", 0, 0};
+static log_throttle_t throttles[BENCH_THROTTLE_MAX];
+static pthread_barrier_t barrier;
+static bool json;
+static bool first = true;
+
+static uint64_t bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void bench_report(const bench_case_t *p_case, uint64_t ops, double ns_per_op)
+{
+    if (json) {
+        printf("{\"name\": \"%s\", \"param\": %u, \"threads\": %u, \"ops\": %llu, \"ns_per_op\": %.2f, \"config\": \"%s\"}\n",
+            p_case->name, p_case->param, p_case->threads, (unsigned long long)ops, ns_per_op, BENCH_CONFIG);
+    } else {
+        if (first) {
+            printf("name,param,threads,ops,ns_per_op,config\n");
+        }
+        printf("%s,%u,%u,%llu,%.2f,%s\n", p_case->name, p_case->param, p_case->threads, (unsigned long long)ops, ns_per_op,
+            BENCH_CONFIG);
+    }
+    first = false;
+    fflush(stdout);
+}
+
+static void raw_pair(uint32_t param)
+{
+    UNUSED(param);
+    for (uint32_t i = 0; i < BENCH_ITER; i++) {
+        void *addr = malloc(32);
+        __asm__ volatile("" : : "r"(addr) : "memory");
+        free(addr);
+    }
+}
+
+/* allocations rotate over param call sites, all freed from one site */
+static void mla_pair(uint32_t param)
+{
+    for (uint32_t i = 0; i < BENCH_ITER; i++) {
+        void *addr = MlaMalloc(32, &sites[i % param]);
+        __asm__ volatile("" : : "r"(addr) : "memory");
+        MlaFree(addr, &free_site);
+    }
+}
+
+static void *bench_thread(void *arg)
+{
+    bench_arg_t *p_arg = (bench_arg_t *)arg;
+    pthread_barrier_wait(&barrier);
+    p_arg->fn(p_arg->param);
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+/* wall time of all threads running fn together, divided by the operations of one thread */
+static double bench_threads(void (*fn)(uint32_t), uint32_t param, uint32_t threads, uint32_t iter)
+{
+    pthread_t thread[BENCH_THREADS_MAX];
+    bench_arg_t arg = {fn, param};
+    double best = 0;
+    for (uint8_t r = 0; r < BENCH_REPEAT; r++) {
+        pthread_barrier_init(&barrier, NULL, threads + 1);
+        for (uint32_t i = 0; i < threads; i++) {
+            pthread_create(&thread[i], NULL, bench_thread, &arg);
+        }
+        pthread_barrier_wait(&barrier);
+        uint64_t start = bench_now();
+        pthread_barrier_wait(&barrier);
+        double ns = (double)(bench_now() - start) / iter;
+        for (uint32_t i = 0; i < threads; i++) {
+            pthread_join(thread[i], NULL);
+        }
+        pthread_barrier_destroy(&barrier);
+        best = (r == 0 || ns < best) ? ns : best;
+    }
+    return best;
+}
+
+static void bench_alloc(void)
+{
+    static const uint32_t site_count[] = {1, 64, 1024, BENCH_SITES_MAX};
+    static const uint32_t thread_count[] = {1, 2, 4, BENCH_THREADS_MAX};
+    for (uint8_t t = 0; t < sizeof(thread_count) / sizeof(thread_count[0]); t++) {
+        bench_case_t raw = {"malloc_free", 0, thread_count[t]};
+        bench_report(&raw, BENCH_ITER, bench_threads(raw_pair, 0, thread_count[t], BENCH_ITER));
+        for (uint8_t s = 0; s < sizeof(site_count) / sizeof(site_count[0]); s++) {
+            bench_case_t mla = {"mla_malloc_free", site_count[s], thread_count[t]};
+            MlaInit();
+            bench_report(&mla, BENCH_ITER, bench_threads(mla_pair, site_count[s], thread_count[t], BENCH_ITER));
+        }
+    }
+}
+
+static void log_raw(uint32_t param)
+{
+    UNUSED(param);
+    for (uint32_t i = 0; i < BENCH_LOG_ITER; i++) {
+        log_out("bench log_out %u\r\n", i);
+    }
+}
+
+static void log_line(uint32_t param)
+{
+    UNUSED(param);
+    for (uint32_t i = 0; i < BENCH_LOG_ITER; i++) {
+        LOGI("bench LOG %u", i);
+    }
+}
+
+/* param sites are throttled in turn, each keeps its own state so the cost should not depend on param */
+static void log_throttle(uint32_t param)
+{
+    for (uint32_t i = 0; i < BENCH_LOG_ITER; i++) {
+        log_throttling(&throttles[i % param], 5);
+    }
+}
+
+static void bench_log(void)
+{
+    static const uint32_t thread_count[] = {1, 4};
+    static const uint32_t throttle_sites[] = {1, 8, BENCH_THROTTLE_MAX};
+    for (uint8_t t = 0; t < sizeof(thread_count) / sizeof(thread_count[0]); t++) {
+        bench_case_t raw = {"log_out", 0, thread_count[t]};
+        bench_report(&raw, BENCH_LOG_ITER, bench_threads(log_raw, 0, thread_count[t], BENCH_LOG_ITER));
+        bench_case_t line = {"log_line", 0, thread_count[t]};
+        bench_report(&line, BENCH_LOG_ITER, bench_threads(log_line, 0, thread_count[t], BENCH_LOG_ITER));
+    }
+    for (uint8_t t = 0; t < sizeof(thread_count) / sizeof(thread_count[0]); t++) {
+        for (uint8_t s = 0; s < sizeof(throttle_sites) / sizeof(throttle_sites[0]); s++) {
+            bench_case_t throttle = {"log_throttling", throttle_sites[s], thread_count[t]};
+            bench_report(&throttle, BENCH_LOG_ITER,
+                bench_threads(log_throttle, throttle_sites[s], thread_count[t], BENCH_LOG_ITER));
+        }
+    }
+}
+
+/* every site keeps one block outstanding and has one freed, so the report lists all of them */
+static void bench_output(void)
+{
+    static const uint32_t site_count[] = {16, 256, BENCH_SITES_MAX};
+    static void *addr[BENCH_SITES_MAX];
+    for (uint8_t s = 0; s < sizeof(site_count) / sizeof(site_count[0]); s++) {
+        bench_case_t output = {"mla_output", site_count[s], 1};
+        MlaInit();
+        for (uint32_t i = 0; i < site_count[s]; i++) {
+            MlaFree(MlaMalloc(32, &sites[i]), &free_site);
+            addr[i] = MlaMalloc(32, &sites[i]);
+        }
+        double best = 0;
+        for (uint8_t r = 0; r < BENCH_REPEAT; r++) {
+            uint64_t start = bench_now();
+            MlaOutput();
+            double ns = (double)(bench_now() - start);
+            best = (r == 0 || ns < best) ? ns : best;
+        }
+        bench_report(&output, 1, best);
+        for (uint32_t i = 0; i < site_count[s]; i++) {
+            MlaFree(addr[i], &free_site);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    json = argc > 1 && strcmp(argv[1], "--json") == 0;
+    for (uint32_t i = 0; i < BENCH_SITES_MAX; i++) {
+        sites[i].file = "mla_bench.c";
+        sites[i].func = "site";
+        sites[i].line = i + 1;
+    }
+    for (uint32_t i = 0; i < BENCH_THROTTLE_MAX; i++) {
+        throttles[i].file = "mla_bench.c";
+        throttles[i].line = i + 1;
+    }
+    log_init();
+    MlaInit();
+    bench_alloc();
+    bench_log();
+    bench_output();
+    MlaDeinit();
+    log_deinit();
+    return 0;
+}
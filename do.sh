@@ -19,7 +19,7 @@
 function help {
 cat <<EOF
 -*- help -*-
-usage: ./do.sh [generate] [make] [exec] [clean] [help]
+usage: ./do.sh [generate] [make] [preload] [snapdiff] [logdecode] [bench] [exec] [clean] [help]
     [generate]: -g -G generate
 
 Example usage of the MLA mechanism
@@ -34,6 +34,27 @@ LOG mechanism implementation analysis
 $ ./do.sh -g LOG
 $ ./do.sh make
 
+Multi-threaded stress test of MLA mechanisms
+$ ./do.sh -g MT
+$ ./do.sh make
+
+Build the LD_PRELOAD library, track an unmodified program
+$ ./do.sh preload
+$ LD_PRELOAD=./libmla.so <program>
+
+Build the tool that compares two snapshots written by MlaSnapshot
+$ ./do.sh snapdiff
+$ ./mla_diff old.snap new.snap
+
+Build the tool that renders a log written with CFG_LOG_BINARY or CFG_LOG_BACKEND_SEGMENT
+$ ./do.sh logdecode
+$ ./log_decode Log.log
+$ ./log_decode Log.*.seg
+
+Benchmark the MLA and LOG hot paths, results as CSV or JSON on stdout
+$ ./do.sh bench
+$ ./do.sh bench --json > bench.jsonl
+
 Execute the program to view the results
 $ ./do.sh exec
 
@@ -48,20 +69,49 @@ function modify_mla_c {
     sed -i 's/#define MLA_MONITOR_INFO    1/#define MLA_MONITOR_INFO    0/' $1
     sed -i 's/void \*MlaMalloc/void \*SV_MlaMalloc/' $1
     sed -i 's/void MlaFree/void SV_MlaFree/' $1
+    sed -i 's/void \*MlaCalloc/void \*SV_MlaCalloc/' $1
+    sed -i 's/void \*MlaRealloc/void \*SV_MlaRealloc/' $1
+    sed -i 's/void \*MlaAlignedAlloc/void \*SV_MlaAlignedAlloc/' $1
+    sed -i 's/int MlaPosixMemalign/int SV_MlaPosixMemalign/' $1
+    sed -i 's/bool MlaOwned/bool SV_MlaOwned/' $1
+    sed -i 's/uint32_t MlaUsableSize/uint32_t SV_MlaUsableSize/' $1
     sed -i 's/int MlaOutput/int SV_MlaOutput/' $1
+    sed -i 's/int MlaSnapshot/int SV_MlaSnapshot/' $1
+    sed -i 's/int MlaReportRequest/int SV_MlaReportRequest/' $1
+    sed -i 's/int MlaSetMode/int SV_MlaSetMode/' $1
+    sed -i 's/int MlaGetMode/int SV_MlaGetMode/' $1
     sed -i 's/void MlaInit/void SV_MlaInit/' $1
+    sed -i 's/int MlaDeinit/int SV_MlaDeinit/' $1
+    sed -i 's/void MlaStat/void SV_MlaStat/' $1
 }
 
 function modify_mla_h {
     sed -i 's/#include "adapter.h"/#include "mla.h"/' $1
-    sed -i 's/malloc(size)/MlaMalloc(size, __FILENAME__, __func__, __LINE__)/' $1
-    sed -i 's/free(addr)/MlaFree(addr, __FILENAME__, __func__, __LINE__)/' $1
+    sed -i 's/ malloc(size)$/ MlaMalloc(size, MLA_SITE())/' $1
+    sed -i 's/ free(addr)$/ MlaFree(addr, MLA_SITE())/' $1
+    sed -i 's/ realloc(addr, size)$/ MlaRealloc(addr, size, MLA_SITE())/' $1
     sed -i 's/PORT_MALLOC(size)    MlaMalloc/SV_PORT_MALLOC(size)    SV_MlaMalloc/' $1
     sed -i 's/PORT_FREE(addr)      MlaFree/SV_PORT_FREE(addr)      SV_MlaFree/' $1
+    sed -i 's/PORT_CALLOC(num, size)    MlaCalloc/SV_PORT_CALLOC(num, size)    SV_MlaCalloc/' $1
+    sed -i 's/PORT_REALLOC(addr, size)    MlaRealloc/SV_PORT_REALLOC(addr, size)    SV_MlaRealloc/' $1
+    sed -i 's/PORT_ALIGNED_ALLOC(alignment, size)    MlaAlignedAlloc/SV_PORT_ALIGNED_ALLOC(alignment, size)    SV_MlaAlignedAlloc/' $1
+    sed -i 's/PORT_POSIX_MEMALIGN(memptr, alignment, size)    MlaPosixMemalign/SV_PORT_POSIX_MEMALIGN(memptr, alignment, size)    SV_MlaPosixMemalign/' $1
     sed -i 's/void \*MlaMalloc/void \*SV_MlaMalloc/' $1
     sed -i 's/void MlaFree/void SV_MlaFree/' $1
+    sed -i 's/void \*MlaCalloc/void \*SV_MlaCalloc/' $1
+    sed -i 's/void \*MlaRealloc/void \*SV_MlaRealloc/' $1
+    sed -i 's/void \*MlaAlignedAlloc/void \*SV_MlaAlignedAlloc/' $1
+    sed -i 's/int MlaPosixMemalign/int SV_MlaPosixMemalign/' $1
+    sed -i 's/bool MlaOwned/bool SV_MlaOwned/' $1
+    sed -i 's/uint32_t MlaUsableSize/uint32_t SV_MlaUsableSize/' $1
     sed -i 's/int MlaOutput/int SV_MlaOutput/' $1
+    sed -i 's/int MlaSnapshot/int SV_MlaSnapshot/' $1
+    sed -i 's/int MlaReportRequest/int SV_MlaReportRequest/' $1
+    sed -i 's/int MlaSetMode/int SV_MlaSetMode/' $1
+    sed -i 's/int MlaGetMode/int SV_MlaGetMode/' $1
     sed -i 's/void MlaInit/void SV_MlaInit/' $1
+    sed -i 's/int MlaDeinit/int SV_MlaDeinit/' $1
+    sed -i 's/void MlaStat/void SV_MlaStat/' $1
 }
 
 function generate_selfverify {
@@ -161,6 +211,55 @@ int main()
 EOF
 }
 
+function generate_mt {
+cat >test.c <<EOF
+#include "adapter.h"
+
+#define TAG    "MT"
+#define THREAD_NUM    8
+#define LOOP_NUM      5000
+
+static void *worker(void *arg)
+{
+    UNUSED(arg);
+    for (uint32_t i = 0; i < LOOP_NUM; i++) {
+        void *ptr = PORT_MALLOC((i%8 + 1)*16);
+        void *keep = PORT_MALLOC(24);
+        PORT_FREE(ptr);
+        if (i % 2) {
+            PORT_FREE(keep);
+        }
+    }
+    return NULL;
+}
+
+int main()
+{
+    pthread_t tid[THREAD_NUM];
+    uint32_t mallocCount = 0;
+    uint32_t freeCount = 0;
+    log_init();
+    MlaInit();
+    for (uint8_t i = 0; i < THREAD_NUM; i++) {
+        pthread_create(&tid[i], NULL, worker, NULL);
+    }
+    for (uint8_t i = 0; i < THREAD_NUM; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    MlaStat(&mallocCount, &freeCount);
+    bool pass = mallocCount == THREAD_NUM*LOOP_NUM*2 && freeCount == THREAD_NUM*LOOP_NUM*3/2;
+    LOGI("[MT] malloc: %u/%u, free: %u/%u. %s", mallocCount, THREAD_NUM*LOOP_NUM*2, freeCount, THREAD_NUM*LOOP_NUM*3/2,
+        pass ? "PASS" : "FAIL");
+    printf("[MT] malloc: %u, free: %u. %s\n", mallocCount, freeCount, pass ? "PASS" : "FAIL");
+
+    MlaOutput();
+    log_deinit();
+
+    return pass ? 0 : -1;
+}
+EOF
+}
+
 function generate_log {
 cat >test.c <<EOF
 #include "adapter.h"
@@ -193,10 +292,25 @@ int main()
 EOF
 }
 
+# enabled CFG_LOG_* / CFG_MLA_* switches of the tree after the -D overrides in \$1, "=VALUE" only when it is not 1
+function bench_config {
+    local flags=$(grep -h "^#define CFG_\(LOG\|MLA\)_[A-Z_]* " adapter.h log.c mla.c mla.h | awk '{print $2"="$3}')
+    for define in $1; do
+        define=${define#-D}
+        flags=$(echo "$flags" | sed "s/^${define%%=*}=.*/$define/")
+    done
+    echo "$flags" | grep -v "=0$" | sed "s/=1$//" | tr '\n' ' ' | sed 's/ $//'
+}
+
 function clean {
     [ -f a.out ] && rm a.out
+    [ -f libmla.so ] && rm libmla.so
+    [ -f mla_diff ] && rm mla_diff
+    [ -f log_decode ] && rm log_decode
+    [ -f mla_bench ] && rm mla_bench
     [ -f build.log ] && rm build.log
     [ -f Log.log ] && rm Log.log
+    ls Log.*.seg >/dev/null 2>&1 && rm Log.*.seg
     [ -f sv_mla.c ] && rm sv_mla.c
     [ -f sv_mla.h ] && rm sv_mla.h
     [ -f self_verify.c ] && rm self_verify.c
@@ -212,6 +326,12 @@ function clean {
 
 function generate {
     [ ! $1 ] && echo -e "\e[47m\e[31m!!Please enter option parameters\e[0m" && exit -1
+    [ $1 = 'MT' ] && {
+        clean
+        generate_mt
+        echo "Generate a multi-threaded stress test of the MLA file."
+        return
+    }
     [ $1 = 'SV' ] && {
         clean
         generate_sv
@@ -257,10 +377,36 @@ function process {
             ;;
         make)
             [[ ! -f self_verify.c && ! -f test.c ]] && echo "!!Run the command './do.sh generate'" && exit -1
-            gcc *.c
-            gcc *.c 2>&1 |grep -e error: -e warning: >build.log
+            gcc *.c -pthread -lm -ldl
+            gcc *.c -pthread -lm -ldl 2>&1 |grep -e error: -e warning: >build.log
             grep -q error: build.log && echo -e "\nBuild Error!" && grep -e error: build.log
             ;;
+        preload)
+            gcc -shared -fPIC -fvisibility=hidden -O2 -DFILTER=VO -I. preload/mla_preload.c mla.c log.c slist.c slab.c pool.c \
+                -o libmla.so -pthread -lm -ldl 2>&1 |grep -e error: -e warning: >build.log
+            grep -q error: build.log && echo -e "\nBuild Error!" && grep -e error: build.log && exit -1
+            echo "Build libmla.so, run the program with LD_PRELOAD=./libmla.so"
+            ;;
+        snapdiff)
+            gcc -O2 -I. tools/mla_diff.c -o mla_diff 2>&1 |grep -e error: -e warning: >build.log
+            grep -q error: build.log && echo -e "\nBuild Error!" && grep -e error: build.log && exit -1
+            echo "Build mla_diff, usage: ./mla_diff old.snap new.snap"
+            ;;
+        logdecode)
+            gcc -O2 -I. tools/log_decode.c -o log_decode 2>&1 |grep -e error: -e warning: >build.log
+            grep -q error: build.log && echo -e "\nBuild Error!" && grep -e error: build.log && exit -1
+            echo "Build log_decode, usage: ./log_decode Log.log | Log.*.seg"
+            ;;
+        bench)
+            # one build per log backend: sync file, async file, segment, binary
+            variants=("" "-DCFG_LOG_ASYNC=1" "-DCFG_LOG_BACKEND_FILE=0 -DCFG_LOG_BACKEND_SEGMENT=1" "-DCFG_LOG_BINARY=1")
+            for i in ${!variants[@]}; do
+                gcc -O2 -DFILTER=I ${variants[$i]} -DBENCH_CONFIG="\"$(bench_config "${variants[$i]}")\"" -I. \
+                    bench/mla_bench.c mla.c log.c slist.c slab.c pool.c -o mla_bench -pthread -lm -ldl 2>&1 |grep -e error: -e warning: >build.log
+                grep -q error: build.log && echo -e "\nBuild Error!" && grep -e error: build.log && exit -1
+                ./mla_bench ${user_arg[1]} | if [ $i -eq 0 ]; then cat; else grep -v "^name,"; fi
+            done
+            ;;
         exec)
             [ ! -f a.out ] && echo "!!Run the command './do.sh make'" && exit -1
             ./a.out
@@ -10,17 +10,72 @@
  */
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include "adapter.h"
+#include "logbin.h"
+#include "logseg.h"
 
 #define TAG    "LOG"
+/* the backends and CFG_LOG_ASYNC can also be chosen with -D, as do.sh bench does */
+#ifndef CFG_LOG_BACKEND_TERMINAL
 #define CFG_LOG_BACKEND_TERMINAL    0
+#endif
+#ifndef CFG_LOG_BACKEND_FILE
 #define CFG_LOG_BACKEND_FILE        1
+#endif
+#ifndef CFG_LOG_BACKEND_FLASH
 #define CFG_LOG_BACKEND_FLASH       0
+#endif
+#ifndef CFG_LOG_BACKEND_SEGMENT
+#define CFG_LOG_BACKEND_SEGMENT     0  // preallocated files written through mmap, rotated by size or time
+#endif
 #define CFG_THROTTLING_MODE         THROTTLING_MODE_COUNT
 #define THROTTLING_MODE_COUNT    1  // To limit viewership of log output
 #define THROTTLING_MODE_TIME     2  // To limit viewership of log time interval
 
-#define LOG_THROTTLING_RECORDER_SIZE    (10)
+#define LOG_SEGMENT_NAME      "Log"  // files Log.0.seg, Log.1.seg, ...
+#define LOG_SEGMENT_SIZE      (4 * 1024 * 1024)  // bytes per file including the head
+#define LOG_SEGMENT_FILES     (4)  // the oldest file is reused once all of them exist
+#define LOG_SEGMENT_PERIOD    (0)  // seconds before the next segment is started, 0: only when full
+#define LOG_SEGMENT_RETRY     (1)  // seconds before another segment is tried after one could not be created
+#if CFG_LOG_BACKEND_SEGMENT
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifndef CFG_LOG_ASYNC
+#define CFG_LOG_ASYNC               0  // format on the calling thread, write to the backends from a background thread
+#endif
+#define LOG_ASYNC_SIZE              (64 * 1024)  // ring buffer bytes, must be a power of 2
+#define CFG_LOG_OVERFLOW            LOG_OVERFLOW_COUNT
+#define LOG_OVERFLOW_DROP     1  // drop records silently while the ring buffer is full
+#define LOG_OVERFLOW_COUNT    2  // drop records and report how many once the writer catches up
+#define LOG_OVERFLOW_BLOCK    3  // wait for the writer thread to make room
+#if CFG_LOG_ASYNC
+#include <sched.h>
+#include <semaphore.h>
+#endif
+
+#define CFG_LOG_LINE    1  // OUTPUT fragments are kept per thread and written as one record when the line ends
+#define LOG_LINE_SIZE    (LOG_BUFFER_SIZE * 2)
+
+#define LOG_CLOCK    CLOCK_REALTIME  // read through the vDSO; the coarse clock only moves once per kernel tick, too slow for the milliseconds
+#ifdef CLOCK_MONOTONIC_COARSE
+#define LOG_TICK_CLOCK    CLOCK_MONOTONIC_COARSE  // throttling, not moved by changes of the wall clock
+#else
+#define LOG_TICK_CLOCK    CLOCK_MONOTONIC
+#endif
+
+#define LOG_BINARY_SIZE    (512)  // largest binary record, long string arguments are cut to fit
+#define LOG_BINARY_SITES   (4096)  // sites whose dictionary is repeated at the start of each segment
+
+#if CFG_LOG_BINARY
+static pthread_mutex_t binary_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t binary_count;  // dictionary ids handed out
+static uint32_t binary_epoch;  // a new log starts without dictionary
+static log_site_t *binary_sites[LOG_BINARY_SITES];  // by id - 1
+#endif
 
 uint32_t BKDRHash(char *str)
 {
@@ -36,157 +91,116 @@ uint32_t BKDRHash(char *str)
 }
 
 /**
- * @brief  log timestamp
+ * @brief  log timestamp, "MM/DD HH:MM:SS.mmm" for the first line of each minute and "SS.mmm" for the rest of it
+ * the text of the current second is kept per thread, a call within the same second only writes the milliseconds
+ * a call with today_ms gets the full form and does not count as a line
  */
 char *get_current_time(uint32_t *today_ms)
 {
-    static char currentTime[20] = {0};
-    // Used to obtain the complete timestamp including the date
-    static bool time_all = true;
-    // Because there are multiple calls to the time interface, in order to ensure the uniqueness of the timestamp
-    static uint16_t time_us = 0;
+    static __thread struct {
+        time_t second;
+        time_t minute;  // of the last full timestamp handed out for a line
+        char text[20];
+    } log_time = {-1, -1, {0}};
 
-    static uint8_t minute_history = 0;
-    if (strlen(currentTime) > 10) {
-        minute_history = (currentTime[9] - '0') * 10 + (currentTime[10] - '0');
+    struct timespec now;
+    clock_gettime(LOG_CLOCK, &now);
+    uint16_t ms = now.tv_nsec / 1000000;
+    if (now.tv_sec != log_time.second) {
+        struct tm date;
+        localtime_r(&now.tv_sec, &date);
+        strftime(log_time.text, sizeof(log_time.text), "%m/%d %H:%M:%S.", &date);
+        log_time.second = now.tv_sec;
     }
+    log_time.text[15] = '0' + ms / 100;
+    log_time.text[16] = '0' + ms / 10 % 10;
+    log_time.text[17] = '0' + ms % 10;
+    log_time.text[18] = '\0';
 
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    struct tm* date = localtime(&now);
-    memset(currentTime, 0, sizeof(currentTime));
-    strftime(currentTime, sizeof(currentTime), "%M", date);
-    uint8_t minute = (currentTime[0] - '0') * 10 + (currentTime[1] - '0');
-
-    if (minute != minute_history) {
-        time_all = true;
+    if (today_ms != NULL) {
+        // Get the number of seconds for the day
+        *today_ms = now.tv_sec%86400*1000 + ms;
+        return log_time.text;
     }
-    if (time_all && today_ms == NULL || today_ms != NULL) {
-        if (today_ms == NULL) {
-            time_all = false;
-        } else {
-            time_us = now.tv_usec/1000;
-        }
-        strftime(currentTime, sizeof(currentTime), "%m/%d %H:%M:%S", date);
-        snprintf(currentTime + 14, 5, ".%03ld", now.tv_usec / 1000);
-    } else {
-        if (time_us == 0) {
-            time_us = now.tv_usec/1000;
-        }
-        strftime(currentTime, sizeof(currentTime), "%S", date);
-        snprintf(currentTime + 2, 5, ".%03ld", time_us);
+    if (now.tv_sec / 60 != log_time.minute) {
+        log_time.minute = now.tv_sec / 60;
+        return log_time.text;
     }
 
-    if (today_ms != NULL) {
-        // Get the number of seconds for the day
-        *today_ms = now.tv_sec%86400*1000 + now.tv_usec/1000;
+    return log_time.text + 12;  // "SS.mmm"
+}
+
+static log_throttle_t *throttle_list;
+
+static void throttle_report(log_throttle_t *site, uint32_t dropped)
+{
+    const char *file = strrchr(site->file, '\\') ? strrchr(site->file, '\\') + 1 : site->file;
+    uint32_t first_ms = mla_atomic_load(&site->first_ms);
+    OUTPUT("W>%s " "{%.8s} " "<%s: %u> (%02u.%03u)""discard times: %u\r\n", get_current_time(NULL), TAG,
+        file, site->line, first_ms/1000%60, first_ms%1000, dropped);
+}
+
+static void throttle_drop(log_throttle_t *site)
+{
+    if (mla_atomic_add(&site->dropped, 1) == 0) {
+        uint32_t today_ms;
+        get_current_time(&today_ms);
+        mla_atomic_set(&site->first_ms, today_ms);
     }
+    uint8_t listed = 0;
+    if (mla_atomic_load(&site->listed) == 0 && mla_atomic_cas(&site->listed, &listed, 1)) {
+        log_throttle_t *head = mla_atomic_load(&throttle_list);
+        do {
+            site->next = head;
+        } while (!mla_atomic_cas(&throttle_list, &head, site));
+    }
+}
 
-    return currentTime;
+/* drops that were not followed by another line of their site */
+static void throttle_flush(void)
+{
+    for (log_throttle_t *site = mla_atomic_load(&throttle_list); site != NULL; site = site->next) {
+        uint32_t dropped = mla_atomic_xchg(&site->dropped, 0);
+        if (dropped != 0) {
+            throttle_report(site, dropped);
+        }
+    }
 }
 
 /**
  * @brief log throttling
+ * token bucket per call site, refilled with log_hz tokens per second; it holds log_hz tokens in
+ * THROTTLING_MODE_COUNT and one in THROTTLING_MODE_TIME, where lines are at least 1000/log_hz ms apart;
+ * the number of dropped lines is reported before the next line of the site gets through
  */
-bool log_throttling(char *file, uint16_t line, uint8_t log_hz)
+bool log_throttling(log_throttle_t *site, uint8_t log_hz)
 {
-    typedef struct {
-        uint32_t hash;
-        uint32_t today_ms;
-        char file[48];
-        uint16_t line;
-        uint16_t count;
-    } log_throttling_info;
-
-    static struct {
-        uint8_t write;
-        uint8_t read;  // reserved
-        bool empty;
-    } log_throttling_handle = {0, 0, true};
-
-    static log_throttling_info log_data[LOG_THROTTLING_RECORDER_SIZE] = {0};
-
-    char buf[64] = {0};
-    CHECK(file != NULL, "log throttling arg is null", false);
-    snprintf(buf, sizeof(buf) - 1, "%s:%u", file, line);
-    uint32_t hash = BKDRHash(buf);
-
-    uint32_t today_ms;
-    char time_stamp[20];
-    memcpy(time_stamp, get_current_time(&today_ms), sizeof(time_stamp));
-
-    if (log_throttling_handle.empty) {
-        log_data[0].hash = hash;
-        log_data[0].today_ms = today_ms;
-        log_data[0].line = line;
-        memcpy(log_data[0].file, file, sizeof(log_data[0].file));
-        log_throttling_handle.empty = false;
-        log_throttling_handle.write = 1;
-        return false;
-    }
-
-    // Clearing old data in logger with limited viewership of logs
-    for (uint8_t i = 0; i < LOG_THROTTLING_RECORDER_SIZE; i++) {
-        uint8_t index = i + log_throttling_handle.write;
-        if (index >= LOG_THROTTLING_RECORDER_SIZE) {
-            index -= LOG_THROTTLING_RECORDER_SIZE;
-        }
-        if (log_data[index].today_ms == 0) {
-            continue;
-        }
+    CHECK(site != NULL, "log throttling arg is null", false);
+    CHECK(log_hz != 0, "log throttling rate is 0", false);
+    struct timespec now;
+    clock_gettime(LOG_TICK_CLOCK, &now);
+    uint64_t now_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    uint64_t interval = 1000000 / log_hz;
 #if CFG_THROTTLING_MODE == THROTTLING_MODE_TIME
-        if (today_ms - log_data[index].today_ms >= 1000/log_hz) {
-            if (log_data[index].count > 0) {
-                OUTPUT("W>%s " "{%.8s} " "<%s: %u> (%02u.%03u)""discard times: %u\r\n", time_stamp, TAG,
-                    log_data[index].file, log_data[index].line, log_data[index].today_ms/1000%60,
-                    log_data[index].today_ms%1000, log_data[index].count);
-            }
-            memset(&log_data[index], 0, sizeof(log_throttling_info));
-        }
+    uint64_t burst = 0;
 #elif CFG_THROTTLING_MODE == THROTTLING_MODE_COUNT
-        if (today_ms - log_data[index].today_ms > 1000) {
-            if (log_data[index].count - log_hz > 0) {
-                OUTPUT("W>%s " "{%.8s} " "<%s: %u> (%02u.%03u)""discard times: %u\r\n", time_stamp, TAG,
-                    log_data[index].file, log_data[index].line, log_data[index].today_ms/1000%60,
-                    log_data[index].today_ms%1000, log_data[index].count - log_hz);
-            }
-            memset(&log_data[index], 0, sizeof(log_throttling_info));
-        }
+    uint64_t burst = interval * (log_hz - 1);
 #endif
-    }
 
-    // Limited viewership of high frequency logs
-    for (uint8_t i = 0; i < LOG_THROTTLING_RECORDER_SIZE; i++) {
-        if (hash == log_data[i].hash) {
-#if CFG_THROTTLING_MODE == THROTTLING_MODE_TIME
-            if (today_ms - log_data[i].today_ms < 1000/log_hz) {
-                log_data[i].count += 1;
-                log_throttling_handle.read = i;
-                return true;
-            }
-#elif CFG_THROTTLING_MODE == THROTTLING_MODE_COUNT
-            if (today_ms - log_data[i].today_ms < 1000) {
-                log_data[i].count += 1;
-                if (log_data[i].count < log_hz) {
-                    return false;
-                } else {
-                    return true;
-                }
-            }
-#endif
+    uint64_t tat = mla_atomic_load(&site->tat);
+    do {
+        if (now_us + burst < tat) {
+            throttle_drop(site);
+            return true;
         }
-    }
+    } while (!mla_atomic_cas(&site->tat, &tat, (tat > now_us ? tat : now_us) + interval));
 
-    uint8_t index = log_throttling_handle.write;
-    if (index >= LOG_THROTTLING_RECORDER_SIZE) {
-        index = 0;
+    if (mla_atomic_load(&site->dropped) != 0) {
+        uint32_t dropped = mla_atomic_xchg(&site->dropped, 0);
+        if (dropped != 0) {
+            throttle_report(site, dropped);
+        }
     }
-    log_data[index].hash = hash;
-    log_data[index].today_ms = today_ms;
-    log_data[index].line = line;
-    memcpy(log_data[index].file, file, sizeof(log_data[index].file));
-    log_throttling_handle.write = index + 1;
-
     return false;
 }
 
@@ -213,6 +227,64 @@ bool log_control(char *tag)
     return ret;
 }
 
+#if CFG_LOG_BINARY
+typedef struct {
+    uint16_t pos;
+    bool full;
+    char buf[LOG_BINARY_SIZE];
+} log_record_t;
+
+static void binary_begin(log_record_t *rec, uint8_t type)
+{
+    rec->buf[0] = type;
+    rec->pos = sizeof(logbin_record_t);
+    rec->full = false;
+}
+
+/* once a value does not fit nothing more is added, the record stays decodable up to there */
+static void binary_put(log_record_t *rec, const void *data, uint16_t len)
+{
+    if (rec->full || rec->pos + len > LOG_BINARY_SIZE) {
+        rec->full = true;
+        return;
+    }
+    memcpy(rec->buf + rec->pos, data, len);
+    rec->pos += len;
+}
+
+static void binary_string(log_record_t *rec, const char *str)
+{
+    uint16_t room = LOG_BINARY_SIZE - rec->pos;
+    binary_put(rec, str, room > 0 ? strnlen(str, room - 1) : 0);
+    binary_put(rec, "", 1);
+}
+
+static uint16_t binary_end(log_record_t *rec)
+{
+    uint16_t size = rec->pos - sizeof(logbin_record_t);
+    memcpy(rec->buf + offsetof(logbin_record_t, size), &size, sizeof(size));
+    return rec->pos;
+}
+
+static void binary_text(log_record_t *rec, const char *text, uint16_t len)
+{
+    binary_begin(rec, LOGBIN_TEXT);
+    binary_put(rec, text, len < LOG_BINARY_SIZE - rec->pos ? len : LOG_BINARY_SIZE - rec->pos);
+}
+
+static uint16_t binary_dict_record(log_record_t *rec, const log_site_t *site)
+{
+    binary_begin(rec, LOGBIN_DICT);
+    binary_put(rec, &site->id, sizeof(site->id));
+    binary_put(rec, &site->line, sizeof(site->line));
+    binary_string(rec, site->level);
+    binary_string(rec, site->tag + (site->tag[0] == '#'));
+    binary_string(rec, site->file);
+    binary_string(rec, site->format);
+    return binary_end(rec);
+}
+#endif
+
 #if CFG_LOG_BACKEND_FILE
 FILE *logFile = NULL;
 
@@ -230,7 +302,6 @@ static int output_file(FILE *file, char *buf, uint16_t len)
 {
     if (file != NULL) {
         fwrite(buf, len, 1, file);
-        fflush(file);
     }
 
     return 0;
@@ -238,9 +309,9 @@ static int output_file(FILE *file, char *buf, uint16_t len)
 #endif
 
 #if CFG_LOG_BACKEND_TERMINAL
-static int output_terminal(char *buf)
+static int output_terminal(char *buf, uint16_t len)
 {
-    printf("%s", buf);
+    fwrite(buf, len, 1, stdout);
     return 0;
 }
 #endif
@@ -318,11 +389,603 @@ int sync_flash(char *buf)
 }
 #endif
 
+#if CFG_LOG_BACKEND_SEGMENT
+static struct {
+    char *base;
+    uint64_t sequence;
+    time_t open_sec;
+    time_t retry_sec;  // no new segment is tried before this once one failed, e.g. on a full disk
+    uint32_t dropped;  // records that did not fit while no new segment could be created
+    pthread_mutex_t lock;
+} log_segment = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void segment_path(char *path, uint16_t size, uint64_t sequence)
+{
+    snprintf(path, size, "%s.%u.seg", LOG_SEGMENT_NAME, (uint32_t)(sequence % LOG_SEGMENT_FILES));
+}
+
+static void segment_close(void)
+{
+    if (log_segment.base != NULL) {
+        munmap(log_segment.base, LOG_SEGMENT_SIZE);
+        log_segment.base = NULL;
+    }
+}
+
+#if CFG_LOG_BINARY
+/* the dictionary of every site seen so far opens the segment, so it decodes without the ones before */
+static void segment_dict(void)
+{
+    logseg_head_t *head = (logseg_head_t *)log_segment.base;
+    uint32_t count = mla_atomic_load(&binary_count);
+    for (uint32_t i = 0; i < count && i < LOG_BINARY_SITES; i++) {
+        log_record_t rec;
+        log_site_t *site = mla_atomic_load(&binary_sites[i]);
+        if (site == NULL) {
+            continue;
+        }
+        uint16_t len = binary_dict_record(&rec, site);
+        if (head->used + len > LOG_SEGMENT_SIZE / 2) {
+            break;
+        }
+        memcpy(log_segment.base + sizeof(logseg_head_t) + head->used, rec.buf, len);
+        mla_atomic_store(&head->used, head->used + len);
+    }
+}
+#endif
+
+/* the file is emptied and allocated in full, so writing into the mapping never needs the disk to grow */
+static int segment_open(uint64_t sequence)
+{
+    char path[64];
+    struct timespec now;
+    segment_path(path, sizeof(path), sequence);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, 0) != 0 || posix_fallocate(fd, 0, LOG_SEGMENT_SIZE) != 0) {
+        printf("Failed to create log segment %s.\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    char *base = mmap(NULL, LOG_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("Failed to map log segment %s.\n", path);
+        return -1;
+    }
+    segment_close();
+
+    clock_gettime(LOG_CLOCK, &now);
+    logseg_head_t *head = (logseg_head_t *)base;
+    head->version = LOGSEG_VERSION;
+    head->head_size = sizeof(logseg_head_t);
+    head->flags = CFG_LOG_BINARY ? LOGSEG_FLAG_BINARY : 0;
+    head->size = LOG_SEGMENT_SIZE;
+    head->sequence = sequence;
+    head->open_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    head->used = 0;
+    mla_atomic_store(&head->magic, LOGSEG_MAGIC);
+    log_segment.base = base;
+    log_segment.sequence = sequence;
+    log_segment.open_sec = now.tv_sec;
+#if CFG_LOG_BINARY
+    segment_dict();
+#endif
+    return 0;
+}
+
+/* continues after the newest segment left by an earlier run */
+static int init_log_segment(void)
+{
+    uint64_t sequence = 0;
+    for (uint32_t i = 0; i < LOG_SEGMENT_FILES; i++) {
+        char path[64];
+        logseg_head_t head;
+        segment_path(path, sizeof(path), i);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        if (pread(fd, &head, sizeof(head), 0) == sizeof(head) && head.magic == LOGSEG_MAGIC &&
+            head.sequence + 1 > sequence) {
+            sequence = head.sequence + 1;
+        }
+        close(fd);
+    }
+    mla_lock(&log_segment.lock);
+    int ret = segment_open(sequence);
+    mla_unlock(&log_segment.lock);
+    return ret;
+}
+
+static void deinit_log_segment(void)
+{
+    mla_lock(&log_segment.lock);
+    if (log_segment.dropped != 0) {
+        printf("%u log records dropped, no new log segment could be created.\n", log_segment.dropped);
+        log_segment.dropped = 0;
+    }
+    segment_close();
+    mla_unlock(&log_segment.lock);
+}
+
+static int segment_append(const char *buf, uint16_t len)
+{
+    logseg_head_t *head = (logseg_head_t *)log_segment.base;
+    if (sizeof(logseg_head_t) + head->used + len > LOG_SEGMENT_SIZE) {
+        return -1;
+    }
+    memcpy(log_segment.base + sizeof(logseg_head_t) + head->used, buf, len);
+    mla_atomic_store(&head->used, head->used + len);
+    return 0;
+}
+
+/* a failed rotation is not retried on every line, and the lines lost meanwhile are noted in the next segment */
+static void segment_rotate(time_t now_sec)
+{
+    if (now_sec < log_segment.retry_sec) {
+        return;
+    }
+    if (segment_open(log_segment.sequence + 1) != 0) {
+        log_segment.retry_sec = now_sec + LOG_SEGMENT_RETRY;
+        return;
+    }
+    log_segment.retry_sec = 0;
+    if (log_segment.dropped != 0) {
+        char note[64];
+        int size = snprintf(note, sizeof(note), "W>{%.8s} log segment full, %u records dropped\r\n", TAG,
+            log_segment.dropped);
+#if CFG_LOG_BINARY
+        log_record_t rec;
+        binary_text(&rec, note, size);
+        segment_append(rec.buf, binary_end(&rec));
+#else
+        segment_append(note, size);
+#endif
+        log_segment.dropped = 0;
+    }
+}
+
+static int output_segment(char *buf, uint16_t len)
+{
+    int ret = -1;
+    mla_lock(&log_segment.lock);
+    logseg_head_t *head = (logseg_head_t *)log_segment.base;
+    if (head != NULL) {
+        struct timespec now = {0};
+        bool expired = false;
+        bool full = sizeof(logseg_head_t) + head->used + len > LOG_SEGMENT_SIZE;
+        if (LOG_SEGMENT_PERIOD != 0 || full) {
+            clock_gettime(LOG_CLOCK, &now);
+            expired = LOG_SEGMENT_PERIOD != 0 && now.tv_sec - log_segment.open_sec >= LOG_SEGMENT_PERIOD;
+        }
+        if (full || expired) {
+            segment_rotate(now.tv_sec);
+        }
+        ret = segment_append(buf, len);
+        if (ret != 0) {
+            log_segment.dropped++;
+        }
+    }
+    mla_unlock(&log_segment.lock);
+    return ret;
+}
+#endif
+
+static int log_write(char *buf, uint16_t len)
+{
+    int ret = 0;
+#if CFG_LOG_BACKEND_TERMINAL
+    ret = output_terminal(buf, len);
+#endif
+#if CFG_LOG_BACKEND_FILE
+    ret = output_file(logFile, buf, len);
+#endif
+#if CFG_LOG_BACKEND_FLASH
+    ret = output_flash(buf, len);
+#endif
+#if CFG_LOG_BACKEND_SEGMENT
+    ret = output_segment(buf, len);
+#endif
+    return ret;
+}
+
+static void log_flush(void)
+{
+#if CFG_LOG_BACKEND_FILE
+    if (logFile != NULL) {
+        fflush(logFile);
+    }
+#endif
+}
+
+#if CFG_LOG_ASYNC
+#define LOG_RECORD_READY       (0x80000000)  // set in the header once the text is in place
+#define LOG_RECORD_ALIGN(n)    (((n) + 7) & ~7u)
+
+/*
+ * lock-free ring with many producers and the writer thread as the only consumer
+ * a record is a uint32_t header and the text, 8-byte aligned; head and tail run freely and wrap by masking
+ * producers reserve room by moving head with a CAS, copy the text and publish it by storing the header,
+ * the writer takes records in order and zeroes them before moving tail, so a header it has not seen reads as 0
+ */
+static struct {
+    char buf[LOG_ASYNC_SIZE] __attribute__((aligned(8)));
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t dropped;
+    uint8_t sleeping;  // the writer waits on wake
+    bool running;
+    sem_t wake;
+    pthread_t writer;
+} log_async;
+
+static uint32_t *async_header(uint32_t pos)
+{
+    return (uint32_t *)(log_async.buf + (pos & (LOG_ASYNC_SIZE - 1)));
+}
+
+static void async_copy_in(uint32_t pos, const void *data, uint32_t len)
+{
+    uint32_t offset = pos & (LOG_ASYNC_SIZE - 1);
+    uint32_t first = len < LOG_ASYNC_SIZE - offset ? len : LOG_ASYNC_SIZE - offset;
+    memcpy(log_async.buf + offset, data, first);
+    memcpy(log_async.buf, (const char *)data + first, len - first);
+}
+
+static void async_copy_out(uint32_t pos, void *data, uint32_t len)
+{
+    uint32_t offset = pos & (LOG_ASYNC_SIZE - 1);
+    uint32_t first = len < LOG_ASYNC_SIZE - offset ? len : LOG_ASYNC_SIZE - offset;
+    memcpy(data, log_async.buf + offset, first);
+    memcpy((char *)data + first, log_async.buf, len - first);
+}
+
+static void async_wake(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);  // pairs with the fence in async_idle
+    if (mla_atomic_load(&log_async.sleeping) && mla_atomic_xchg(&log_async.sleeping, 0)) {
+        sem_post(&log_async.wake);
+    }
+}
+
+static int async_push(char *buf, uint16_t len)
+{
+    uint32_t need = LOG_RECORD_ALIGN(sizeof(uint32_t) + len);
+    if (need > LOG_ASYNC_SIZE) {
+        mla_atomic_add(&log_async.dropped, 1);
+        return -1;
+    }
+    uint32_t head = mla_atomic_load(&log_async.head);
+    for (;;) {
+        if (!mla_atomic_load(&log_async.running)) {
+            mla_atomic_add(&log_async.dropped, 1);
+            return -1;
+        }
+        uint32_t used = head - mla_atomic_load(&log_async.tail);
+        if (used > LOG_ASYNC_SIZE) {
+            head = mla_atomic_load(&log_async.head);  // read before the writer moved tail past it
+            continue;
+        }
+        if (LOG_ASYNC_SIZE - used >= need) {
+            if (mla_atomic_cas(&log_async.head, &head, head + need)) {
+                break;
+            }
+            continue;
+        }
+#if CFG_LOG_OVERFLOW == LOG_OVERFLOW_BLOCK
+        async_wake();
+        sched_yield();
+        head = mla_atomic_load(&log_async.head);
+#else
+        mla_atomic_add(&log_async.dropped, 1);
+        return -1;
+#endif
+    }
+    async_copy_in(head + sizeof(uint32_t), buf, len);
+    mla_atomic_store(async_header(head), len | LOG_RECORD_READY);
+    async_wake();
+    return 0;
+}
+
+/* nothing is ready: report the drops, flush, and sleep unless a record was published meanwhile */
+static void async_idle(void)
+{
+    uint32_t dropped = mla_atomic_xchg(&log_async.dropped, 0);
+#if CFG_LOG_OVERFLOW == LOG_OVERFLOW_COUNT
+    if (dropped != 0) {
+        char note[64];
+        int size = snprintf(note, sizeof(note), "W>{%.8s} async buffer full, %u records dropped\r\n", TAG, dropped);
+#if CFG_LOG_BINARY
+        log_record_t rec;
+        binary_text(&rec, note, size);
+        log_write(rec.buf, binary_end(&rec));
+#else
+        log_write(note, size);
+#endif
+    }
+#else
+    UNUSED(dropped);
+#endif
+    log_flush();
+
+    if (!mla_atomic_load(&log_async.running)) {
+        sched_yield();  // stopping, a producer still has to publish the record it reserved
+        return;
+    }
+    mla_atomic_store(&log_async.sleeping, 1);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!(mla_atomic_load(async_header(log_async.tail)) & LOG_RECORD_READY) && mla_atomic_load(&log_async.running)) {
+        sem_wait(&log_async.wake);
+    }
+    mla_atomic_store(&log_async.sleeping, 0);
+}
+
+/* records are written without any lock, the backend is flushed whenever the ring runs empty */
+static void *async_writer(void *arg)
+{
+    static char record[LOG_ASYNC_SIZE];
+    UNUSED(arg);
+    for (;;) {
+        uint32_t tail = log_async.tail;
+        uint32_t header = mla_atomic_load(async_header(tail));
+        if (!(header & LOG_RECORD_READY)) {
+            if (!mla_atomic_load(&log_async.running) && tail == mla_atomic_load(&log_async.head)) {
+                break;
+            }
+            async_idle();
+            continue;
+        }
+        uint32_t len = header & ~LOG_RECORD_READY;
+        uint32_t need = LOG_RECORD_ALIGN(sizeof(uint32_t) + len);
+        async_copy_out(tail + sizeof(uint32_t), record, len);
+        uint32_t offset = tail & (LOG_ASYNC_SIZE - 1);
+        uint32_t first = need < LOG_ASYNC_SIZE - offset ? need : LOG_ASYNC_SIZE - offset;
+        memset(log_async.buf + offset, 0, first);
+        memset(log_async.buf, 0, need - first);
+        mla_atomic_store(&log_async.tail, tail + need);
+        log_write(record, len);
+    }
+    async_idle();
+    return NULL;
+}
+
+static int async_start(void)
+{
+    memset(log_async.buf, 0, sizeof(log_async.buf));
+    log_async.head = 0;
+    log_async.tail = 0;
+    log_async.dropped = 0;
+    log_async.sleeping = 0;
+    sem_init(&log_async.wake, 0, 0);
+    mla_atomic_store(&log_async.running, true);
+    if (pthread_create(&log_async.writer, NULL, async_writer, NULL) != 0) {
+        log_async.running = false;
+        sem_destroy(&log_async.wake);
+        printf("Failed to create log writer.\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* records published before the stop are written out, later ones are dropped */
+static void async_stop(void)
+{
+    if (!mla_atomic_xchg(&log_async.running, false)) {
+        return;
+    }
+    sem_post(&log_async.wake);
+    pthread_join(log_async.writer, NULL);
+    sem_destroy(&log_async.wake);
+}
+#endif
+
+static int log_emit(char *buf, uint16_t len)
+{
+#if CFG_LOG_ASYNC
+    return async_push(buf, len);
+#else
+    int ret = log_write(buf, len);
+    log_flush();
+    return ret;
+#endif
+}
+
+/* a whole line, or what is staged of it, as one record */
+static int log_record(char *buf, uint16_t len)
+{
+#if CFG_LOG_BINARY
+    log_record_t rec;
+    binary_text(&rec, buf, len);
+    return log_emit(rec.buf, binary_end(&rec));
+#else
+    return log_emit(buf, len);
+#endif
+}
+
+#if CFG_LOG_LINE
+/* the LOG macros write prefix, message and line end with separate OUTPUT calls, they reach the backend together */
+static __thread struct {
+    uint16_t len;
+    bool exit_set;
+    char buf[LOG_LINE_SIZE];
+} log_line;
+static pthread_key_t line_key;
+static pthread_once_t line_once = PTHREAD_ONCE_INIT;
+
+static int line_commit(void)
+{
+    int ret = 0;
+    if (log_line.len != 0) {
+        ret = log_record(log_line.buf, log_line.len);
+        log_line.len = 0;
+    }
+    return ret;
+}
+
+/* a thread that ends in the middle of a line still gets it written */
+static void line_exit(void *arg)
+{
+    UNUSED(arg);
+    line_commit();
+}
+
+static void line_key_create(void)
+{
+    pthread_key_create(&line_key, line_exit);
+}
+
+static int line_append(char *buf, uint16_t len)
+{
+    int ret = 0;
+    if (!log_line.exit_set) {
+        pthread_once(&line_once, line_key_create);
+        pthread_setspecific(line_key, &log_line);
+        log_line.exit_set = true;
+    }
+    if (log_line.len + len > LOG_LINE_SIZE) {
+        ret = line_commit();
+    }
+    memcpy(log_line.buf + log_line.len, buf, len);
+    log_line.len += len;
+    if (len != 0 && buf[len - 1] == '\n') {
+        ret = line_commit();
+    }
+    return ret;
+}
+#endif
+
+#if CFG_LOG_BINARY
+static int binary_head(void)
+{
+    log_record_t rec;
+    logbin_head_t head = {LOGBIN_MAGIC, LOGBIN_VERSION};
+    pthread_mutex_lock(&binary_lock);
+    mla_atomic_add(&binary_epoch, 1);
+    binary_begin(&rec, LOGBIN_HEAD);
+    binary_put(&rec, &head, sizeof(head));
+    int ret = log_emit(rec.buf, binary_end(&rec));
+    pthread_mutex_unlock(&binary_lock);
+    return ret;
+}
+
+/* the dictionary record of a site is written before its first event of each log */
+static uint32_t binary_dict(log_site_t *site, const char *format)
+{
+    if (mla_atomic_load(&site->epoch) == mla_atomic_load(&binary_epoch)) {
+        return site->id;
+    }
+    pthread_mutex_lock(&binary_lock);
+    uint32_t epoch = mla_atomic_load(&binary_epoch);
+    if (site->epoch != epoch) {
+        if (site->id == 0) {
+            site->format = format;
+            site->id = binary_count + 1;
+            if (site->id <= LOG_BINARY_SITES) {
+                mla_atomic_store(&binary_sites[site->id - 1], site);
+            }
+            mla_atomic_store(&binary_count, site->id);
+        }
+        log_record_t rec;
+        log_emit(rec.buf, binary_dict_record(&rec, site));
+        mla_atomic_store(&site->epoch, epoch);
+    }
+    pthread_mutex_unlock(&binary_lock);
+    return site->id;
+}
+
+static void binary_integer(log_record_t *rec, int64_t value)
+{
+    binary_put(rec, &value, sizeof(value));
+}
+
+/* walks the conversions like printf does and stores each argument raw, tools/log_decode.c walks them the same way */
+static void binary_args(log_record_t *rec, const char *format, va_list args)
+{
+    for (const char *p = format; *p != '\0' && !rec->full; p++) {
+        if (*p != '%' || *++p == '%') {
+            continue;
+        }
+        while (*p != '\0' && strchr("-+ #0'", *p)) {
+            p++;
+        }
+        if (*p == '*') {
+            binary_integer(rec, va_arg(args, int));
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+        if (*p == '.') {
+            if (*++p == '*') {
+                binary_integer(rec, va_arg(args, int));
+                p++;
+            }
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+        char length = 0;
+        while (*p != '\0' && strchr("hljztL", *p)) {
+            length = (length == *p) ? (char)(*p - 32) : *p;  // hh -> H, ll -> L
+            p++;
+        }
+        switch (*p) {
+            case 'd': case 'i':
+                binary_integer(rec, length == 'l' ? va_arg(args, long) : length == 'L' ? va_arg(args, long long) :
+                    length == 'j' ? va_arg(args, intmax_t) : length == 'z' ? va_arg(args, ssize_t) :
+                    length == 't' ? va_arg(args, ptrdiff_t) : length == 'h' ? (short)va_arg(args, int) :
+                    length == 'H' ? (signed char)va_arg(args, int) : va_arg(args, int));
+                break;
+            case 'u': case 'o': case 'x': case 'X': case 'c':
+                binary_integer(rec, length == 'l' ? va_arg(args, unsigned long) :
+                    length == 'L' ? va_arg(args, unsigned long long) : length == 'j' ? va_arg(args, uintmax_t) :
+                    length == 'z' ? va_arg(args, size_t) : length == 't' ? (uint64_t)va_arg(args, ptrdiff_t) :
+                    length == 'h' ? (unsigned short)va_arg(args, int) :
+                    length == 'H' ? (unsigned char)va_arg(args, int) : va_arg(args, unsigned int));
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                double value = length == 'L' ? (double)va_arg(args, long double) : va_arg(args, double);
+                binary_put(rec, &value, sizeof(value));
+                break;
+            }
+            case 's': {
+                const char *str = va_arg(args, const char *);
+                str = str == NULL ? "(null)" : str;
+                uint32_t room = LOG_BINARY_SIZE - rec->pos;
+                uint16_t len = strnlen(str, room > sizeof(uint16_t) ? room - sizeof(uint16_t) : 0);
+                binary_put(rec, &len, sizeof(len));
+                binary_put(rec, str, len);
+                break;
+            }
+            case 'p':
+                binary_integer(rec, (int64_t)(uintptr_t)va_arg(args, void *));
+                break;
+            case 'n':
+                UNUSED(va_arg(args, void *));
+                break;
+            default:
+                return;  // not a conversion printf knows, the decoder stops at the same place
+        }
+    }
+}
+#endif
+
 int log_init(void)
 {
     int ret = 0;
 #if CFG_LOG_BACKEND_FILE
     ret =  init_log_file();
+#endif
+#if CFG_LOG_BACKEND_SEGMENT
+    ret = ret == 0 ? init_log_segment() : ret;
+#endif
+#if CFG_LOG_ASYNC
+    ret = ret == 0 ? async_start() : ret;
+#endif
+#if CFG_LOG_BINARY
+    ret = ret == 0 ? binary_head() : ret;
 #endif
     return ret;
 }
@@ -330,8 +993,19 @@ int log_init(void)
 int log_deinit(void)
 {
     int ret = 0;
+    throttle_flush();
+#if CFG_LOG_LINE
+    line_commit();
+#endif
+#if CFG_LOG_ASYNC
+    async_stop();
+#endif
 #if CFG_LOG_BACKEND_FILE
     ret = fclose(logFile);
+    logFile = NULL;
+#endif
+#if CFG_LOG_BACKEND_SEGMENT
+    deinit_log_segment();
 #endif
     return ret;
 }
@@ -345,16 +1019,39 @@ int log_out(const char *format, ...)
     vsnprintf(log_buffer, sizeof(log_buffer), format, args);
     uint16_t len = strlen(log_buffer);
 
-#if CFG_LOG_BACKEND_TERMINAL
-    ret = output_terminal(log_buffer);
-#endif
-#if CFG_LOG_BACKEND_FILE
-    ret = output_file(logFile, log_buffer, len);
-#endif
-#if CFG_LOG_BACKEND_FLASH
-    ret = output_flash(log_buffer, len);
+#if CFG_LOG_LINE
+    ret = line_append(log_buffer, len);
+#else
+    ret = log_record(log_buffer, len);
 #endif
 
     va_end(args);
     return ret;
 }
+
+/**
+ * @brief  binary counterpart of the LOG prefix and message, the text is rendered by tools/log_decode.c
+ */
+int log_binary(log_site_t *site, const char *format, ...)
+{
+#if CFG_LOG_BINARY
+    log_record_t rec;
+    struct timespec now;
+    uint32_t id = binary_dict(site, format);
+    clock_gettime(LOG_CLOCK, &now);
+    uint64_t time_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+    binary_begin(&rec, LOGBIN_EVENT);
+    binary_put(&rec, &id, sizeof(id));
+    binary_put(&rec, &time_us, sizeof(time_us));
+    va_list args;
+    va_start(args, format);
+    binary_args(&rec, format, args);
+    va_end(args);
+    return log_emit(rec.buf, binary_end(&rec));
+#else
+    UNUSED(site);
+    UNUSED(format);
+    return -1;
+#endif
+}
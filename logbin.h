@@ -0,0 +1,40 @@
+/**
+ * @file logbin.h
+ * @author skull (skull.gu@gmail.com)
+ * @brief binary log format written with CFG_LOG_BINARY, rendered offline by tools/log_decode.c
+ * @version 0.1
+ * @date 2024-01-27
+ *
+ * @copyright Copyright (c) 2024 skull
+ *
+ * layout: record | record | ...   each record is logbin_record_t followed by size bytes of payload
+ * the first record is LOGBIN_HEAD, every call site writes its LOGBIN_DICT once before its first LOGBIN_EVENT
+ * values are in the byte order of the writer
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define LOGBIN_MAGIC      (0x474F4C4D)  // "MLOG"
+#define LOGBIN_VERSION    (1)
+
+#define LOGBIN_HEAD     0  // payload: logbin_head_t
+#define LOGBIN_DICT     1  // payload: id, line (uint32_t), then level, tag, file, format as NUL-terminated strings
+#define LOGBIN_EVENT    2  // payload: id (uint32_t), wall clock in us (uint64_t), then the arguments in format order
+#define LOGBIN_TEXT     3  // payload: text written by OUTPUT directly, without a format
+
+/*
+ * arguments of an event, one per conversion of the format including '*' width and precision:
+ * integers, characters and pointers as 64 bits, floating point as double,
+ * strings as a uint16_t length and the bytes without NUL; '%n' and '%%' take no space
+ * a record cut short by the size limit ends after its last complete argument
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint16_t size;
+} logbin_record_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+} logbin_head_t;
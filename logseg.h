@@ -0,0 +1,33 @@
+/**
+ * @file logseg.h
+ * @author skull (skull.gu@gmail.com)
+ * @brief log segment files written with CFG_LOG_BACKEND_SEGMENT, readable while the writer runs or after it crashed
+ * @version 0.1
+ * @date 2024-01-27
+ *
+ * @copyright Copyright (c) 2024 skull
+ *
+ * layout: head | data[used] | zeros up to size
+ * files are reused in turn, the one with the highest sequence is the newest,
+ * its last record ends at head_size + used; used only ever covers complete records
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define LOGSEG_MAGIC      (0x4745534C)  // "LSEG"
+#define LOGSEG_VERSION    (1)
+
+#define LOGSEG_FLAG_BINARY    0x1  // data is a stream of logbin.h records without the LOGBIN_HEAD
+
+typedef struct {
+    uint32_t magic;  // written last when a segment is started
+    uint16_t version;
+    uint16_t head_size;  // data starts here
+    uint32_t flags;
+    uint32_t size;  // file size
+    uint64_t sequence;  // one more than the segment before
+    uint64_t open_ms;  // wall clock when the segment was started
+    uint32_t used;  // data bytes, stored after each record is in place
+    uint32_t reserved;
+} logseg_head_t;
@@ -8,14 +8,69 @@
  * @copyright Copyright (c) 2023 skull
  *
  */
+#define _GNU_SOURCE  // dladdr
+#include <math.h>
+#include <errno.h>
+#include <stddef.h>
 #include "adapter.h"
+#include "snapshot.h"
 
 #define TAG    "MLA"
-#define MEM_ID_SIZE    (4)  // sizeof(Hash("file: line"))
+#define MLA_ALIGN      (_Alignof(max_align_t))  // 与malloc返回地址的对齐保证一致
+#define MEM_ID_SIZE    ((sizeof(MlaHead_t) + MLA_ALIGN - 1) & ~(MLA_ALIGN - 1))
 #define MLA_MONITOR_INFO    1  // 监控所有内存使用信息
 #define CFG_MLA_VERBOSE     1  // 记录释放位置，进一步定位泄漏位置
 #define CFG_MLA_FUNCTION    1  // 内存使用信息携带函数名
-#define MLA_HASH_VERIFY     1  // 检查hash值是否重复
+#define MLA_HASH_BUCKET_SIZE    (1024)  // 记录器hash索引的桶数，须为2的幂；不会扩容，查找平均遍历(记录器数/桶数)项，应不小于预期的调用点数(STACK模式下为调用栈数)
+#define MLA_FREE_BUCKET_SIZE    (1024)  // 释放位置索引的桶数，须为2的幂；同样不会扩容，应不小于预期的(申请记录器, 释放调用点)组合数
+#define MLA_LOCK_SHARDS         (16)  // 调用点插入锁的分片数，须为2的幂
+#define MLA_SLAB_PAGE_SIZE      (16 * 1024)  // 记录器slab每页的字节数，使用内存池时不超过其最大一级
+#define MLA_SIZE_CLASSES        (32)  // 申请大小按log2分级，第i级为[2^i, 2^(i+1))，0与1归入第0级
+#define CFG_MLA_THREAD_CACHE    0  // 线程私有计数缓存，输出、线程退出或达到阈值时合并到全局记录器
+#define MLA_CACHE_SIZE          (64)  // 每个线程缓存的记录器数，须为2的幂
+#define MLA_CACHE_THRESHOLD     (1024)  // 单个记录器未合并的计数达到该值时合并
+#define CFG_MLA_LIVE_TABLE      0  // 按地址记录每块未释放内存的大小、调用点和申请时间，输出各调用点最早未释放的内存
+#define MLA_LIVE_SIZE           (1 << 16)  // 存活内存表容量，须为2的幂
+#define MLA_LIVE_PROBE          (64)  // 插入与删除的最大探测次数
+#define MLA_LIVE_OLDEST         (3)  // 每个调用点输出最早的几块
+#define CFG_MLA_SAMPLE          0  // 按字节泊松采样，只完整记录被采样的申请，输出按权重放大的估计值
+#define MLA_SAMPLE_RATE         (512 * 1024)  // 平均每多少字节采样一次
+#define MLA_WEIGHT_SCALE        (1024)  // 采样权重以1/MLA_WEIGHT_SCALE为单位按整数累加，热路径只需原子加
+#define CFG_MLA_STACK           0  // 沿帧指针回溯申请时的调用栈，同一调用点按调用栈分别记录，需以-fno-omit-frame-pointer编译
+#define MLA_STACK_DEPTH         (8)  // 回溯的栈帧数
+#define MLA_STACK_SIZE          (4096)  // 去重后的调用栈表容量，须为2的幂
+#define MLA_STACK_PROBE         (64)
+#define MLA_STACK_SPAN          (1 << 20)  // 相邻栈帧的最大间距，超出视为帧指针已失效
+#define MLA_STACK_TEXT_SIZE     (512)  // 快照中一个调用栈的文本长度上限
+#define CFG_MLA_LIFETIME        0  // 头部记录申请时刻，释放时按调用点统计内存存活时长的分布，用于选择适合内存池的调用点
+#define MLA_LIFETIME_CLASSES    (32)  // 存活时长按log2分级，第i级为[2^i, 2^(i+1))us，第0级含不足1us，最后一级含更长的时长
+#define CFG_MLA_REPORTER        0  // 后台线程输出报告，格式化与输出不占用申请释放的线程
+#define MLA_REPORT_PERIOD       (10000)  // 周期输出的间隔，单位ms，0表示只在请求时输出
+#define MLA_REPORT_SIGNAL       SIGUSR1  // 收到该信号时输出一次报告，0表示不安装信号处理函数
+
+#if CFG_MLA_STACK
+#include <dlfcn.h>
+#endif
+#if CFG_MLA_REPORTER
+#include <signal.h>
+#include <semaphore.h>
+#endif
+
+#if CFG_MLA_SAMPLE
+#define MLA_MODE_DEFAULT    MLA_MODE_SAMPLED
+#elif CFG_MLA_VERBOSE
+#define MLA_MODE_DEFAULT    MLA_MODE_VERBOSE
+#else
+#define MLA_MODE_DEFAULT    MLA_MODE_COUNTS
+#endif
+
+#if CFG_MLA_POOL && MLA_SLAB_PAGE_SIZE > POOL_SIZE_MAX
+#define MLA_SLAB_PAGE    (POOL_SIZE_MAX)
+#else
+#define MLA_SLAB_PAGE    (MLA_SLAB_PAGE_SIZE)
+#endif
+/* 一页slab扣除页头后可容纳的记录数，按slab_init的方式对齐记录大小 */
+#define MLA_SLAB_CHUNKS(type)    ((MLA_SLAB_PAGE - sizeof(slab_page_t)) / ((sizeof(type) + sizeof(void *) - 1) & ~(sizeof(void *) - 1)))
 
 #define MLA_OUTPUT(...)      LOGV(__VA_ARGS__); LOGV("\r\n");
 
@@ -34,43 +89,180 @@ static const char * const SplitLine = "*----------------------------------------
 static const char * const OVSplitLine = "*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%  MLA  Verbose  %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*";
 #endif
 
+enum {MLA_COUNT_MALLOC, MLA_COUNT_FREE, MLA_COUNT_MAX};
+
 #if CFG_MLA_VERBOSE
-typedef struct {
+typedef struct _mlaFreeInfo {
     mla_list_node_t node;
-    uint32_t hash;
+    struct _mla *item;  // 所属的申请记录器
+    struct _mlaFreeInfo *hashNext;  // freeBucket中的下一项
+    MlaSite_t *site;
     uint32_t line;
-    char file[32];
+    const char *file;
 #if CFG_MLA_FUNCTION
-    char func[32];
+    const char *func;
 #endif
     uint32_t freeCount;
 } MlaFreeInfo_t;
 #endif
 
 /* 内存分配记录器结构，可用来记录内存使用状态，借助shell或文件方便查看是否存在内存泄漏 */
-typedef struct {
+typedef struct _mla {
     mla_list_node_t node;
+    struct _mla *hashNext;  // 同一hash桶内的下一个记录器
+    MlaSite_t *site;
     uint32_t hash;
     uint32_t line;
-    char file[32];
+    const char *file;
 #if CFG_MLA_FUNCTION
-    char func[32];
+    const char *func;
 #endif
     uint32_t mallocCount;
     uint32_t freeCount;
+    uint32_t dirty;  // 自上次增量输出后计数有变化，已挂入dirtyList
+    struct _mla *dirtyNext;
+    struct _mla *reportNext;  // 增量输出时暂存待输出的记录器，受recorderLock保护
+#if CFG_MLA_STACK
+    uint32_t stack;  // 调用栈编号，0表示未能记录
+#endif
+    uint64_t liveBytes;  // 未释放的字节数
+    uint64_t peakBytes;  // liveBytes的历史最大值
+    uint64_t totalBytes;  // 累计申请的字节数，realloc增大的部分也计入
+    uint32_t sizeClass[MLA_SIZE_CLASSES];  // 各级申请大小的申请次数
 #if CFG_MLA_VERBOSE
-    uint32_t size;
     mla_list_node_t freeInfo;
+    mla_list_node_t *freeTail;  // freeInfo链表尾，受所在分片的锁保护
+#endif
+#if CFG_MLA_SAMPLE
+    uint64_t weight[MLA_COUNT_MAX];  // 被采样内存的权重之和，单位1/MLA_WEIGHT_SCALE，即申请释放次数的估计值
+    uint64_t variance[MLA_COUNT_MAX];  // 估计值的方差之和
+#endif
+#if CFG_MLA_LIFETIME
+    uint32_t lifetime[MLA_LIFETIME_CLASSES];  // 各级存活时长的释放次数
 #endif
 } Mla_t;
 
+/* 申请内存时额外多申请MEM_ID_SIZE，存放记录器地址及申请大小；MEM_ID_SIZE按MLA_ALIGN补齐，返回地址不破坏原有对齐 */
+typedef struct {
+    Mla_t *item;
+    uint32_t size;
+    uint16_t flag;
+    uint16_t offset;  // 按更大粒度对齐申请时头部距实际申请地址的偏移，单位MLA_ALIGN
+#if CFG_MLA_LIFETIME
+    uint64_t stamp;  // 申请时刻，单位us，realloc不改变
+#endif
+} MlaHead_t;
+
+#define MLA_HEAD(addr)    ((MlaHead_t *)((uint8_t *)(addr) - MEM_ID_SIZE))
+#define MLA_BASE(head)    ((uint8_t *)(head) - (head)->offset * MLA_ALIGN)
+#define MLA_FLAG_UNTRACKED    (0x1)  // 关闭记录或未被采样时申请，释放时不做记录
+#define MLA_FLAG_SAMPLED      (0x2)  // 采样模式下被采样，统计时按采样权重放大
+#define MLA_FLAG_TAG          (0xA500)  // 高字节固定标记，区分MLA申请的内存
+#define MLA_FLAG_TAG_MASK     (0xFF00)
+#define MLA_TAGGED(addr)    ((MLA_HEAD(addr)->flag & MLA_FLAG_TAG_MASK) == MLA_FLAG_TAG)
+
 typedef struct {
     uint16_t verboseIndex;
     Mla_t mla;
 } VerbosePrintInfo_t;
 
 static mla_list_node_t recorderList;
+static mla_list_node_t *recorderTail;  // 链表尾，追加新调用点时无需遍历
+static Mla_t *recorderBucket[MLA_HASH_BUCKET_SIZE];  // 以hash为键的调用点索引，链表仅用于保持输出顺序
 static uint16_t mlaIndex;
+static uint32_t mlaSiteCount;  // 已分配的调用点编号
+/* 热路径(已有调用点的计数)无锁，只有新增调用点及释放位置子链表需要加锁 */
+static mla_lock_t recorderLock;  // 保护recorderList的追加与遍历
+static mla_lock_t outputLock;  // 串行化报告输出(mlaIndex)，并阻止输出期间MlaReset释放记录器；先于recorderLock获取
+static mla_lock_t shardLock[MLA_LOCK_SHARDS];  // 按hash桶分片，保护桶内插入及释放位置子链表
+/* MLA自身的记录从专用slab分配，不与被观测的堆混在一起，MlaInit/MlaDeinit时整体释放 */
+static mla_slab_t recorderSlab;
+#if CFG_MLA_VERBOSE
+static mla_slab_t freeInfoSlab;
+static MlaFreeInfo_t *freeBucket[MLA_FREE_BUCKET_SIZE];  // 以(申请记录器, 释放调用点)为键的释放位置索引，只增不删
+#endif
+static uint64_t mlaLiveBytes;  // 全部调用点未释放的字节数
+static uint64_t mlaPeakBytes;  // mlaLiveBytes的历史最大值
+static uint64_t mlaLiveBlocks;  // 头部指向记录器且未释放的内存块数，不为0时不能释放记录器
+static Mla_t *dirtyList;  // 计数有变化的记录器，无锁压入，增量输出时整体取走
+static bool mlaReady;
+static int mlaMode = MLA_MODE_DEFAULT;  // 运行时记录模式，切换只影响之后的申请
+#if CFG_MLA_REPORTER
+static sem_t reportSem;  // 每次请求post一次，后台线程等待超时即为周期输出
+static bool reporterReady;
+static bool reporterStop;  // MlaDeinit时置位，后台线程被唤醒后退出
+static pthread_t reporter;
+#if MLA_REPORT_SIGNAL
+static struct sigaction reportAction;  // 安装前的信号处理，停止时恢复
+#endif
+#endif
+
+_Static_assert((MLA_HASH_BUCKET_SIZE & (MLA_HASH_BUCKET_SIZE - 1)) == 0 && MLA_HASH_BUCKET_SIZE >= MLA_LOCK_SHARDS,
+    "MLA_HASH_BUCKET_SIZE must be a power of 2 no less than MLA_LOCK_SHARDS");
+#define MLA_BUCKET(hash)    (((hash) ^ ((hash) >> 16)) & (MLA_HASH_BUCKET_SIZE - 1))
+#define MLA_SHARD(hash)     (MLA_BUCKET(hash) & (MLA_LOCK_SHARDS - 1))
+_Static_assert((MLA_FREE_BUCKET_SIZE & (MLA_FREE_BUCKET_SIZE - 1)) == 0, "MLA_FREE_BUCKET_SIZE must be a power of 2");
+#define MLA_FREE_BUCKET(hash)    (((hash) ^ ((hash) >> 16)) & (MLA_FREE_BUCKET_SIZE - 1))
+
+
+#if CFG_MLA_LIVE_TABLE
+/* 开放寻址的存活内存表，以地址为键；addr先以BUSY占位，写完其余字段后再发布，输出时跳过未发布的槽位 */
+typedef struct {
+    void *addr;
+    Mla_t *item;
+    uint32_t size;
+    uint32_t stamp;  // 申请时刻，单位ms
+} MlaLive_t;
+
+#define MLA_LIVE_TOMB    ((void *)1)  // 已删除，可被再次插入
+#define MLA_LIVE_BUSY    ((void *)2)  // 正在插入
+#define MLA_LIVE_SLOT(addr)    ((uint32_t)(((uintptr_t)(addr) * 0x9E3779B97F4A7C15ull) >> 40) & (MLA_LIVE_SIZE - 1))
+
+static MlaLive_t liveTable[MLA_LIVE_SIZE];
+static uint32_t liveDropped;  // 探测范围内无空位而未记录的块数
+#endif
+
+#if CFG_MLA_SAMPLE
+static __thread int64_t sampleLeft;  // 距下一次采样还剩的字节数
+static __thread uint64_t sampleSeed;
+#endif
+
+#if CFG_MLA_STACK
+/* 相同调用栈只保存一份，记录器以编号(槽位+1)引用；depth为0表示空槽，写完栈帧后再发布depth */
+typedef struct {
+    uint32_t hash;
+    uint32_t depth;
+    void *frame[MLA_STACK_DEPTH];
+} MlaStack_t;
+
+static MlaStack_t stackTable[MLA_STACK_SIZE];
+static mla_lock_t stackLock;  // 只在插入新调用栈时加锁
+static uint32_t stackDropped;  // 探测范围内无空位而未记录的次数
+#endif
+
+#if CFG_MLA_THREAD_CACHE
+/* 线程缓存项，count只由所属线程递增，merged记录已合并到记录器的部分，合并时需持有缓存锁 */
+typedef struct {
+    Mla_t *item;
+    uint32_t count[MLA_COUNT_MAX];
+    uint32_t merged[MLA_COUNT_MAX];
+} MlaCacheEntry_t;
+
+typedef struct {
+    mla_list_node_t node;
+    mla_lock_t lock;
+    MlaCacheEntry_t entry[MLA_CACHE_SIZE];
+} MlaCache_t;
+
+static __thread MlaCache_t *mlaCache;
+static pthread_key_t cacheKey;  // 线程退出时合并并注销该线程的缓存
+static mla_lock_t cacheLock;  // 保护cacheList
+static mla_list_node_t cacheList;
+static bool cacheReady;  // 各线程仍持有自己的缓存，MlaDeinit后保留，再次初始化时沿用
+static mla_slab_t cacheSlab;
+
+#define MLA_CACHE_SLOT(item)    ((((uintptr_t)(item) >> 4) ^ ((uintptr_t)(item) >> 12)) & (MLA_CACHE_SIZE - 1))
+#endif
 
 static int8_t assert_abort(void)
 {
@@ -94,344 +286,1857 @@ void MlaRegisterBackend()
 #endif
 
 #if CFG_MLA_VERBOSE
-static int MlaCheckFree(void **p_arg, mla_list_node_t **p_node)
+static uint32_t MlaFreeHash(Mla_t *item, uint32_t id)
 {
-    CHECK(*p_arg != NULL, -1);
-    CHECK(*p_node != NULL, -1);
-    MlaFreeInfo_t *recorder = (MlaFreeInfo_t *)(*p_node);
-    if (recorder->hash == *((uint32_t *)(*p_arg))) {
-        return 1;
-    } else {
-        return 0;
-    }
+    return (uint32_t)(((uintptr_t)item >> 4) * 0x9E3779B1u) ^ (id * 0x85EBCA6Bu);
 }
 
-static Mla_t *MlaFindFreeItem(mla_list_node_t *head, uint32_t hash)
+/* 无锁查找，索引项发布后不再修改键值，也不会被删除 */
+static MlaFreeInfo_t *MlaFindFreeItem(Mla_t *item, MlaSite_t *site, uint32_t hash)
 {
-    CHECK(head != NULL, NULL);
-    return (MlaFreeInfo_t *)mla_slist_foreach(head, MlaCheckFree, &hash);
+    MlaFreeInfo_t *freeInfo = mla_atomic_load(&freeBucket[MLA_FREE_BUCKET(hash)]);
+    while (freeInfo != NULL && (freeInfo->item != item || freeInfo->site != site)) {
+        freeInfo = freeInfo->hashNext;
+    }
+    return freeInfo;
 }
 #if MLA_DEBUG
 static int PrintListInfo(void **p_arg, mla_list_node_t **p_node)
 {
     MlaFreeInfo_t *info = (MlaFreeInfo_t *)(*p_node);
     MLA_LOG("----------------------------------------------------------------");
-    MLA_LOG("%p, %u, %u, %s, %u", &info->node, info->hash, info->line, info->file, info->freeCount);
+    MLA_LOG("%p, %u, %u, %s, %u", &info->node, info->site->id, info->line, info->file, info->freeCount);
     MLA_LOG("----------------------------------------------------------------");
     return 0;
 }
 #endif
-static void MlaAddFreeItem(mla_list_node_t *head, MlaFreeInfo_t *item)
+/* 追加到记录器的释放位置链表尾并发布到索引，调用者持有记录器所在分片的锁；不同分片的记录器可能共用一个桶，桶头以CAS插入 */
+static void MlaAddFreeItem(Mla_t *item, MlaFreeInfo_t *freeInfo, uint32_t hash)
 {
-    CHECK(head != NULL);
     CHECK(item != NULL);
-    LOGD("%s - %s. %s:%u", __FILENAME__, __func__, item->file, item->line);
-    mla_list_add_tail(head, &item->node);
+    CHECK(freeInfo != NULL);
+    LOGD("%s - %s. %s:%u", __FILENAME__, __func__, freeInfo->file, freeInfo->line);
+    mla_list_add(item->freeTail, &freeInfo->node);
+    item->freeTail = &freeInfo->node;
+    MlaFreeInfo_t **bucket = &freeBucket[MLA_FREE_BUCKET(hash)];
+    MlaFreeInfo_t *head = mla_atomic_load(bucket);
+    do {
+        freeInfo->hashNext = head;
+    } while (!mla_atomic_cas(bucket, &head, freeInfo));
 #if MLA_DEBUG
-    mla_slist_foreach(head, PrintListInfo, NULL);
+    mla_slist_foreach(&item->freeInfo, PrintListInfo, NULL);
 #endif
 }
+#endif
 
-static int MlaProcessFreeNode(void **p_arg, mla_list_node_t **p_node)
+/* 首次使用调用点时分配编号，此后热路径只使用缓存的编号；并发首次使用时以先写入者为准 */
+static uint32_t MlaSiteId(MlaSite_t *site)
 {
-    CHECK(*p_arg != NULL, -1);
-    CHECK(*p_node != NULL, -1);
-    mla_list_del(*p_arg, *p_node);
-    MLA_FREE(*p_node);
-    *p_node = *p_arg;
-    return 0;
+    uint32_t id = mla_atomic_load(&site->id);
+    if (id == 0) {
+        uint32_t expect = 0;
+        id = mla_atomic_add(&mlaSiteCount, 1) + 1;
+        if (!mla_atomic_cas(&site->id, &expect, id)) {
+            id = expect;
+        }
+    }
+    return id;
 }
 
-static void MlaDelFreeItem(Mla_t *item)
+static const char *MlaFileName(const char *file)
 {
-    CHECK(item != NULL);
-    LOGD("%s - %s. %s:%u", __FILENAME__, __func__, item->file, item->line);
-    mla_slist_foreach(&item->freeInfo, MlaProcessFreeNode, &item->freeInfo);
+    return strrchr(file, '\\') ? (strrchr(file, '\\') + 1) : file;
 }
-#endif
 
-static int MlaProcess(void **p_arg, mla_list_node_t **p_node)
+/* 记录器键值由调用点编号生成，同一调用点不同大小的申请合并记录，STACK模式下再按调用栈区分 */
+static uint32_t MlaItemHash(uint32_t id, uint32_t stack)
 {
-    CHECK(*p_arg != NULL, -1);
-    CHECK(*p_node != NULL, -1);
-    Mla_t *recorder = (Mla_t *)(*p_node);
-    if (recorder->hash == *((uint32_t *)(*p_arg))) {
-        return 1;
-    } else {
-        return 0;
-    }
+    uint32_t hash = id;
+#if CFG_MLA_STACK
+    hash ^= stack * 0x85EBCA6B;
+#else
+    UNUSED(stack);
+#endif
+    return hash;
 }
 
-static Mla_t *MlaFindItem(mla_list_node_t *head, uint32_t hash)
+static bool MlaMatchItem(Mla_t *item, MlaSite_t *site, uint32_t stack)
 {
-    CHECK(head != NULL, NULL);
-    return (Mla_t *)mla_slist_foreach(head, MlaProcess, &hash);
+#if CFG_MLA_STACK
+    if (item->stack != stack) {
+        return false;
+    }
+#else
+    UNUSED(stack);
+#endif
+    return item->site == site;
 }
 
-static void MlaAddItem(mla_list_node_t *head, Mla_t *item)
+static Mla_t *MlaFindItem(MlaSite_t *site, uint32_t stack, uint32_t hash)
 {
-    CHECK(head != NULL);
-    CHECK(item != NULL);
-    LOGD("%s - %s. %s:%u", __FILENAME__, __func__, item->file, item->line);
-    mla_list_add_tail(head, &item->node);
+    Mla_t *item = mla_atomic_load(&recorderBucket[MLA_BUCKET(hash)]);
+    while (item != NULL && !MlaMatchItem(item, site, stack)) {
+        item = item->hashNext;
+    }
+    return item;
 }
 
-static void MlaDelItem(mla_list_node_t *head, Mla_t *item)
+/* 追加到输出链表；须在释放分片锁之后调用，输出时先持recorderLock再取分片锁，反之会死锁 */
+static void MlaAddItem(mla_list_node_t *head, Mla_t *item)
 {
     CHECK(head != NULL);
     CHECK(item != NULL);
     LOGD("%s - %s. %s:%u", __FILENAME__, __func__, item->file, item->line);
-#if CFG_MLA_VERBOSE
-    MlaDelFreeItem(item);
-#endif
-    mla_list_del(head, &item->node);
-    MLA_FREE(item);
+    mla_lock(&recorderLock);
+    mla_list_add(recorderTail, &item->node);
+    recorderTail = &item->node;
+    mla_unlock(&recorderLock);
 }
 
-static int MlaMallocRecorder(char *file, char *func, uint16_t line, uint32_t size, uint32_t hash)
+static Mla_t *MlaNewItem(MlaSite_t *site, uint32_t stack, uint32_t hash)
 {
-    CHECK(file != NULL);
-#if CFG_MLA_FUNCTION
-    CHECK(func != NULL, NULL);
+    Mla_t *mrecorder = (Mla_t *)mla_slab_alloc(&recorderSlab);
+    if (mrecorder == NULL) {
+        LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+        return NULL;
+    }
+    mrecorder->site = site;
+    mrecorder->hash = hash;
+    mrecorder->line = site->line;
+    mrecorder->mallocCount = 0;
+    mrecorder->freeCount = 0;
+    mrecorder->dirty = 0;
+    mrecorder->dirtyNext = NULL;
+    mrecorder->reportNext = NULL;
+    mrecorder->liveBytes = 0;
+    mrecorder->peakBytes = 0;
+    mrecorder->totalBytes = 0;
+    memset(mrecorder->sizeClass, 0, sizeof(mrecorder->sizeClass));
+#if CFG_MLA_STACK
+    mrecorder->stack = stack;
 #else
-    UNUSED(func);
+    UNUSED(stack);
 #endif
-    Mla_t *item = MlaFindItem(&recorderList, hash);
-    if (item == NULL) {
-        Mla_t *mrecorder = (Mla_t *)MLA_MALLOC(sizeof(Mla_t));
-        if (mrecorder == NULL) {
-            LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
-            return -1;
-        }
-        mrecorder->hash = hash;
-        mrecorder->line = line;
-        mrecorder->mallocCount = 1;
-        mrecorder->freeCount = 0;
-#if CFG_MLA_VERBOSE
-        mrecorder->size = size;
-        mla_list_init(&mrecorder->freeInfo);
+#if CFG_MLA_SAMPLE
+    memset(mrecorder->weight, 0, sizeof(mrecorder->weight));
+    memset(mrecorder->variance, 0, sizeof(mrecorder->variance));
 #endif
-        memcpy(mrecorder->file, file, sizeof(mrecorder->file));
-#if CFG_MLA_FUNCTION
-        memcpy(mrecorder->func, func, sizeof(mrecorder->func));
+#if CFG_MLA_LIFETIME
+    memset(mrecorder->lifetime, 0, sizeof(mrecorder->lifetime));
 #endif
-        MlaAddItem(&recorderList, &mrecorder->node);
-    } else {
-        item->mallocCount += 1;
-#if MLA_HASH_VERIFY
 #if CFG_MLA_VERBOSE
-#if CFG_MLA_FUNCTION
-        if (item->line != line || item->size != size || !!strcmp(item->file, file) || !!strcmp(item->func, func)) {
-#else
-        if (item->line != line || item->size != size || !!strcmp(item->file, file)) {
+    mla_list_init(&mrecorder->freeInfo);
+    mrecorder->freeTail = &mrecorder->freeInfo;
 #endif
-#else
+    mrecorder->file = MlaFileName(site->file);
 #if CFG_MLA_FUNCTION
-        if (item->line != line || !!strcmp(item->file, file) || !!strcmp(item->func, func)) {
-#else
-        if (item->line != line || !!strcmp(item->file, file)) {
-#endif
+    mrecorder->func = site->func;
 #endif
-            LOGE("hint hash dumplicate: %x, %s:%u %s, %u", hash, file, line, func, size);
-            return -2;
+    // 调用者持有该hash所在分片的锁；初始化完成后再挂入hash桶发布，无锁查找不会看到半初始化的记录器
+    Mla_t **bucket = &recorderBucket[MLA_BUCKET(hash)];
+    mrecorder->hashNext = *bucket;
+    mla_atomic_store(bucket, mrecorder);
+    return mrecorder;
+}
+
+/* 计数变化时挂入dirtyList，已标记的记录器只多一次读操作 */
+static void MlaMarkDirty(Mla_t *item)
+{
+    uint32_t clean = 0;
+    if (mla_atomic_load(&item->dirty) || !mla_atomic_cas(&item->dirty, &clean, 1)) {
+        return;
+    }
+    Mla_t *head = mla_atomic_load(&dirtyList);
+    do {
+        item->dirtyNext = head;
+    } while (!mla_atomic_cas(&dirtyList, &head, item));
+}
+
+#if CFG_MLA_THREAD_CACHE
+static void MlaCacheMerge(MlaCache_t *cache)
+{
+    mla_lock(&cache->lock);
+    for (uint16_t i = 0; i < MLA_CACHE_SIZE; i++) {
+        MlaCacheEntry_t *entry = &cache->entry[i];
+        if (entry->item == NULL) {
+            continue;
+        }
+        for (uint8_t j = 0; j < MLA_COUNT_MAX; j++) {
+            uint32_t count = mla_atomic_load(&entry->count[j]);
+            if (count != entry->merged[j]) {
+                mla_atomic_add(j == MLA_COUNT_MALLOC ? &entry->item->mallocCount : &entry->item->freeCount,
+                    count - entry->merged[j]);
+                entry->merged[j] = count;
+                MlaMarkDirty(entry->item);
+            }
         }
-#endif
     }
+    mla_unlock(&cache->lock);
+}
+
+static int MlaCacheMergeNode(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    MlaCacheMerge((MlaCache_t *)(*p_node));
     return 0;
 }
 
-static int MlaFreeRecorder(char *file, char *func, uint16_t line, uint32_t hash)
+/* 将所有线程缓存合并到全局记录器，输出前调用以保证计数精确 */
+static void MlaCacheFlush(void)
 {
-    Mla_t *item = MlaFindItem(&recorderList, hash);
-    if (item == NULL) {
-        LOGE("%s - %s. The freed memory does not exist", __FILENAME__, __func__);
-        return -1;
-    } else {
-        item->freeCount += 1;
-#if !MLA_MONITOR_INFO
-        // 分配与释放次数一致的节点会从内存泄漏检查表中移除
-        if (item->freeCount == item->mallocCount) {
-#if MLA_DEBUG
-            mla_slist_foreach(&item->freeInfo, PrintListInfo, NULL);
+    mla_lock(&cacheLock);
+    mla_slist_foreach(&cacheList, MlaCacheMergeNode, NULL);
+    mla_unlock(&cacheLock);
+}
+
+static void MlaCacheExit(void *arg)
+{
+    MlaCache_t *cache = (MlaCache_t *)arg;
+    mla_lock(&cacheLock);
+    MlaCacheMerge(cache);
+    mla_list_del(&cacheList, &cache->node);
+    mla_unlock(&cacheLock);
+    mlaCache = NULL;
+    mla_slab_free(&cacheSlab, cache);
+}
+
+static int MlaCacheClearNode(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    MlaCache_t *cache = (MlaCache_t *)(*p_node);
+    mla_lock(&cache->lock);
+    memset(cache->entry, 0, sizeof(cache->entry));
+    mla_unlock(&cache->lock);
+    return 0;
+}
+
+static MlaCache_t *MlaCacheGet(void)
+{
+    if (mlaCache == NULL) {
+        MlaCache_t *cache = (MlaCache_t *)mla_slab_alloc(&cacheSlab);
+        if (cache == NULL) {
+            LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+            return NULL;
+        }
+        memset(cache, 0, sizeof(MlaCache_t));
+        mla_lock_init(&cache->lock);
+        mla_lock(&cacheLock);
+        mla_list_add_head(&cacheList, &cache->node);
+        mla_unlock(&cacheLock);
+        pthread_setspecific(cacheKey, cache);
+        mlaCache = cache;
+    }
+    return mlaCache;
+}
+
+/* 缓存已满时先整体合并再清空，清空只由所属线程在持锁时进行 */
+static MlaCacheEntry_t *MlaCacheEntry(MlaCache_t *cache, Mla_t *item)
+{
+    uint16_t slot = MLA_CACHE_SLOT(item);
+    for (uint16_t i = 0; i < MLA_CACHE_SIZE; i++) {
+        MlaCacheEntry_t *entry = &cache->entry[(slot + i) & (MLA_CACHE_SIZE - 1)];
+        if (entry->item == item) {
+            return entry;
+        }
+        if (entry->item == NULL) {
+            mla_lock(&cache->lock);
+            entry->item = item;
+            mla_unlock(&cache->lock);
+            return entry;
+        }
+    }
+    MlaCacheMerge(cache);
+    mla_lock(&cache->lock);
+    memset(cache->entry, 0, sizeof(cache->entry));
+    cache->entry[slot].item = item;
+    mla_unlock(&cache->lock);
+    return &cache->entry[slot];
+}
 #endif
-            MlaDelItem(&recorderList, item);
-            return 0;
+
+/* 申请释放计数，开启线程缓存时只修改本线程的缓存 */
+static void MlaCount(Mla_t *item, uint8_t type)
+{
+#if CFG_MLA_THREAD_CACHE
+    MlaCache_t *cache = MlaCacheGet();
+    if (cache != NULL) {
+        MlaCacheEntry_t *entry = MlaCacheEntry(cache, item);
+        uint32_t count = entry->count[type] + 1;
+        mla_atomic_set(&entry->count[type], count);
+        if (count - entry->merged[type] >= MLA_CACHE_THRESHOLD) {
+            MlaCacheMerge(cache);
         }
+        return;
+    }
 #endif
+    mla_atomic_add(type == MLA_COUNT_MALLOC ? &item->mallocCount : &item->freeCount, 1);
+    MlaMarkDirty(item);
+}
+
+static Mla_t *MlaMallocRecorder(MlaSite_t *site, uint32_t stack)
+{
+    CHECK(site != NULL, NULL);
+    uint32_t hash = MlaItemHash(MlaSiteId(site), stack);
+    Mla_t *item = MlaFindItem(site, stack, hash);
+    if (item == NULL) {
+        mla_lock(&shardLock[MLA_SHARD(hash)]);
+        // 加锁后复查，避免并发首次申请时重复插入
+        item = MlaFindItem(site, stack, hash);
+        bool created = false;
+        if (item == NULL) {
+            item = MlaNewItem(site, stack, hash);
+            created = item != NULL;
+        }
+        mla_unlock(&shardLock[MLA_SHARD(hash)]);
+        if (item == NULL) {
+            return NULL;
+        }
+        if (created) {
+            MlaAddItem(&recorderList, item);
+        }
+    }
+    MlaCount(item, MLA_COUNT_MALLOC);
+    return item;
+}
+
 #if CFG_MLA_VERBOSE
-        char buf[80] = {0};
-#if CFG_MLA_FUNCTION
-        snprintf(buf, sizeof(buf) - 1, "%s:%u %s", file, line, func);
-#else
-        snprintf(buf, sizeof(buf) - 1, "%s:%u", file, line);
-#endif
-        uint32_t hash = BKDRHash(buf);
-        MlaFreeInfo_t *freeInfo = MlaFindFreeItem(&item->freeInfo, hash);
-        if (freeInfo != NULL) {
-            freeInfo->freeCount += 1;
+/* 已出现过的释放位置只需一次无锁查找加原子计数，与非VERBOSE模式的开销相当 */
+static int MlaFreeSiteRecorder(Mla_t *item, MlaSite_t *site)
+{
+    uint32_t hash = MlaFreeHash(item, MlaSiteId(site));
+    MlaFreeInfo_t *freeInfo = MlaFindFreeItem(item, site, hash);
+    if (freeInfo != NULL) {
+        mla_atomic_add(&freeInfo->freeCount, 1);
+        return 0;
+    }
+    int ret = 0;
+    mla_lock(&shardLock[MLA_SHARD(item->hash)]);
+    // 加锁后复查，同一记录器的释放位置只在其分片锁内插入
+    freeInfo = MlaFindFreeItem(item, site, hash);
+    if (freeInfo != NULL) {
+        mla_atomic_add(&freeInfo->freeCount, 1);
+    } else {
+        freeInfo = (MlaFreeInfo_t *)mla_slab_alloc(&freeInfoSlab);
+        if (freeInfo == NULL) {
+            LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+            ret = -3;
         } else {
-            freeInfo = (Mla_t *)MLA_MALLOC(sizeof(MlaFreeInfo_t));
-            if (freeInfo == NULL) {
-                LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
-                return -3;
-            }
-            freeInfo->hash = hash;
-            freeInfo->line = line;
+            freeInfo->item = item;
+            freeInfo->site = site;
+            freeInfo->line = site->line;
             freeInfo->freeCount = 1;
-            memcpy(freeInfo->file, file, sizeof(freeInfo->file));
+            freeInfo->file = MlaFileName(site->file);
 #if CFG_MLA_FUNCTION
-            memcpy(freeInfo->func, func, sizeof(freeInfo->func));
+            freeInfo->func = site->func;
 #endif
-            MlaAddFreeItem(&item->freeInfo, freeInfo);
+            MlaAddFreeItem(item, freeInfo, hash);
         }
-#endif
     }
-
-    return 0;
+    mla_unlock(&shardLock[MLA_SHARD(item->hash)]);
+    return ret;
 }
+#endif
 
-/* 申请内存时额外多申请MEM_ID_SIZE，用以存放hash字段(file:line)，在free时检查释放的是谁申请的，可以统计申请释放次数 */
-void *MlaMalloc(uint32_t size, char *file, char *func, uint16_t line)
+/* 记录器创建后不再释放，无锁查找因此无需担心访问已释放的节点；分配与释放次数一致的记录器在输出时过滤 */
+static int MlaFreeRecorder(Mla_t *item, MlaSite_t *site)
 {
-    CHECK(file != NULL, NULL);
-#if CFG_MLA_FUNCTION
-    CHECK(func != NULL, NULL);
-#else
-    UNUSED(func);
-#endif
-    LOGD("%s - %s. Malloc caller %s:%u %s", __FILENAME__, __func__, file, line, func);
-    void *ptr = MLA_MALLOC(size + MEM_ID_SIZE);
-    if (ptr == NULL) {
-        LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
-        return NULL;
-    } else {
-        char buf[BUFFER_SIZE] = {0};
+    if (item == NULL) {
+        LOGE("%s - %s. The freed memory does not exist", __FILENAME__, __func__);
+        return -1;
+    }
+    MlaCount(item, MLA_COUNT_FREE);
 #if CFG_MLA_VERBOSE
-#if CFG_MLA_FUNCTION
-        snprintf(buf, sizeof(buf) - 1, "%s:%u %s-%u", file, line, func, size);
+    // 关闭记录与计数模式下不记录释放位置
+    return mla_atomic_load(&mlaMode) < MLA_MODE_VERBOSE ? 0 : MlaFreeSiteRecorder(item, site);
 #else
-        snprintf(buf, sizeof(buf) - 1, "%s:%u-%u", file, line, size);
+    UNUSED(site);
+    return 0;
 #endif
+}
+
+#if CFG_MLA_LIVE_TABLE || CFG_MLA_SAMPLE
+/* 单调时钟，单位ms，使用粗粒度时钟源以降低热路径开销 */
+static uint32_t MlaClock(void)
+{
+    struct timespec now;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
 #else
-#if CFG_MLA_FUNCTION
-        snprintf(buf, sizeof(buf) - 1, "%s:%u %s", file, line, func);
-#else
-        snprintf(buf, sizeof(buf) - 1, "%s:%u", file, line);
+    clock_gettime(CLOCK_MONOTONIC, &now);
 #endif
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 #endif
-        uint32_t hash = BKDRHash(buf);
-        *((uint32_t *)ptr) = hash;
-        MlaMallocRecorder(file, func, line, size, hash);
-        return ptr + MEM_ID_SIZE;
-    }
+
+#if CFG_MLA_LIFETIME
+/* 单调时钟，单位us；粗粒度时钟源的精度只有数ms，无法区分短生命周期的内存，这里经vDSO读取精确时钟，同样不进入内核 */
+static uint64_t MlaTick(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
-void MlaFree(void *addr, char *file, char *func, uint16_t line)
+static void MlaLifetimeAdd(Mla_t *item, uint64_t stamp)
 {
-    ASSERT(addr != NULL);
-    CHECK(file != NULL);
-#if CFG_MLA_FUNCTION
-    CHECK(func != NULL, NULL);
-#else
-    UNUSED(func);
+    uint64_t lifetime = MlaTick() - stamp;
+    uint8_t index = lifetime > 1 ? 63 - __builtin_clzll(lifetime) : 0;
+    mla_atomic_add(&item->lifetime[index < MLA_LIFETIME_CLASSES ? index : MLA_LIFETIME_CLASSES - 1], 1);
+}
 #endif
-    LOGD("%s - %s. Free caller %s:%u %s", __FILENAME__, __func__, file, line, func);
-    uint32_t hash = *((uint32_t *)(addr - MEM_ID_SIZE));
-    if ((addr - MEM_ID_SIZE) == NULL) {
-        LOGE("%s - %s : %u. malloc fail!:", __FILENAME__, __func__, __LINE__);
-        return;
-    } else {
-        MLA_FREE(addr - MEM_ID_SIZE);
+
+#if CFG_MLA_SAMPLE
+/* 采样间隔服从均值为MLA_SAMPLE_RATE的指数分布，即按字节的泊松过程 */
+static int64_t MlaSampleNext(void)
+{
+    if (sampleSeed == 0) {
+        sampleSeed = ((uintptr_t)&sampleSeed ^ ((uint64_t)MlaClock() << 32)) | 1;
     }
-    MlaFreeRecorder(file, func, line, hash);
+    sampleSeed ^= sampleSeed >> 12;
+    sampleSeed ^= sampleSeed << 25;
+    sampleSeed ^= sampleSeed >> 27;
+    double u = (double)(((sampleSeed * 0x2545F4914F6CDD1Dull) >> 11) + 1) / 9007199254740992.0;
+    return (int64_t)(-log(u) * MLA_SAMPLE_RATE) + 1;
 }
 
-#if CFG_MLA_VERBOSE
-static int MlaCollectVerboseInfo(void **p_arg, mla_list_node_t **p_node)
+/* 大小为size的申请被采样的概率为1-exp(-size/rate)，被采样的申请以其倒数为权重 */
+static double MlaSampleWeight(uint32_t size)
 {
-    CHECK(*p_node != NULL, -1);
-    CHECK(*p_arg != NULL, -1);
-    VerbosePrintInfo_t *printInfo = (VerbosePrintInfo_t *)(*p_arg);
-    MlaFreeInfo_t *recorder = (MlaFreeInfo_t *)(*p_node);
-    char bufMalloc[32] = {0};
-    if (printInfo->verboseIndex == 1) {
-        MLA_OUTPUT("%s", SplitLine);
-        MLA_OUTPUT("|""%-16s%-32s%-*s""|", "Verbose:", "malloc", BUFFER_SIZE, "free");
-        snprintf(bufMalloc, sizeof(bufMalloc) - 1, "(%u)B - [%u]", printInfo->mla.size, printInfo->mla.mallocCount);
+    return 1.0 / -expm1(-(double)(size ? size : 1) / MLA_SAMPLE_RATE);
+}
+
+static bool MlaSampled(uint32_t size)
+{
+    if (sampleSeed == 0) {
+        sampleLeft = MlaSampleNext();
     }
-    char bufFree[BUFFER_SIZE] = {0};
-#if CFG_MLA_FUNCTION
-    snprintf(bufFree, sizeof(bufFree) - 1, "%s:%u %s - [%u]", recorder->file, recorder->line, recorder->func, recorder->freeCount);
-#else
-    snprintf(bufFree, sizeof(bufFree) - 1, "%s:%u - [%u]", recorder->file, recorder->line, recorder->freeCount);
-#endif
-    MLA_OUTPUT("|""%3u.%-12s%-32s%-*s""|", printInfo->verboseIndex, "", bufMalloc, BUFFER_SIZE, bufFree);
-    printInfo->verboseIndex++;
+    sampleLeft -= size;
+    if (sampleLeft > 0) {
+        return false;
+    }
+    sampleLeft = MlaSampleNext();
+    return true;
+}
 
-    return 0;
+/* 只累计被采样的内存，计数与详细模式下记录的内存已有准确计数，不进入估计值；申请与释放按同一头部标记判断，增减对称 */
+static void MlaSampleAdd(Mla_t *item, uint8_t type, uint16_t flag, uint32_t size)
+{
+    if (!(flag & MLA_FLAG_SAMPLED)) {
+        return;
+    }
+    double weight = MlaSampleWeight(size);
+    mla_atomic_add(&item->weight[type], (uint64_t)llround(weight * MLA_WEIGHT_SCALE));
+    mla_atomic_add(&item->variance[type], (uint64_t)llround(weight * (weight - 1)));
 }
-#endif
 
-static int MlaCollectInfo(void **p_arg, mla_list_node_t **p_node)
+/* realloc后释放时按新大小计权，申请一侧同步换算，估计的未释放量保持一致；差值可能为负，按补码累加 */
+static void MlaSampleMove(Mla_t *item, uint32_t oldSize, uint32_t size)
 {
-    CHECK(*p_node != NULL, -1);
+    double from = MlaSampleWeight(oldSize);
+    double to = MlaSampleWeight(size);
+    mla_atomic_add(&item->weight[MLA_COUNT_MALLOC],
+        (uint64_t)(llround(to * MLA_WEIGHT_SCALE) - llround(from * MLA_WEIGHT_SCALE)));
+    mla_atomic_add(&item->variance[MLA_COUNT_MALLOC], (uint64_t)(llround(to * (to - 1)) - llround(from * (from - 1))));
+}
+#endif
 
-    char buf[BUFFER_SIZE] = {0};
-    Mla_t *recorder = (Mla_t *)(*p_node);
-#if CFG_MLA_FUNCTION
-    snprintf(buf, sizeof(buf) - 1 , "%s:%u %s", recorder->file, recorder->line, recorder->func);
+/* 计入字节统计的大小，被采样的内存按采样权重放大为估计值；同一大小申请与释放时换算结果相同 */
+static int64_t MlaBytes(uint16_t flag, uint32_t size)
+{
+#if CFG_MLA_SAMPLE
+    return (flag & MLA_FLAG_SAMPLED) ? llround(size * MlaSampleWeight(size)) : size;
 #else
-    snprintf(buf, sizeof(buf) - 1, "%s: %u", recorder->file, recorder->line);
+    UNUSED(flag);
+    return size;
 #endif
-    if (*p_arg != NULL && *((bool *)(*p_arg))) {
-        MLA_OUTPUT(" ""%-*s%-16x%-16u%-16u%d", BUFFER_SIZE - 10, buf, recorder->hash, recorder->mallocCount, recorder->freeCount,
-            recorder->mallocCount - recorder->freeCount);
-        return 0;
+}
+
+static void MlaPeak(uint64_t *peak, uint64_t live)
+{
+    uint64_t old = mla_atomic_load(peak);
+    while (live > old && !mla_atomic_cas(peak, &old, live)) {
     }
-#if CFG_MLA_VERBOSE
-    MLA_OUTPUT(">%u", ++mlaIndex);
-    MLA_OUTPUT(" ""%-*s%-16s%-16s%-16s%s", BUFFER_SIZE - 10, "Caller", "Size", "Malloc", "Free", "Diff");
-    MLA_OUTPUT(" ""%-*s%-16u%-16u%-16u%d", BUFFER_SIZE - 10, buf, recorder->size, recorder->mallocCount, recorder->freeCount,
-        recorder->mallocCount - recorder->freeCount);
-    VerbosePrintInfo_t printInfo;
-    printInfo.verboseIndex = 1;
-    memcpy(&printInfo.mla, recorder, sizeof(Mla_t));
-    mla_slist_foreach(&recorder->freeInfo, MlaCollectVerboseInfo, &printInfo);
-    MLA_OUTPUT("%s", SplitLine);
-#endif
+}
 
-    return 0;
+/* 调用点与全局的存活字节数变化delta，增加时同时计入累计字节并更新峰值 */
+static void MlaBytesMove(Mla_t *item, int64_t delta)
+{
+    uint64_t live = mla_atomic_add(&item->liveBytes, (uint64_t)delta) + (uint64_t)delta;
+    uint64_t total = mla_atomic_add(&mlaLiveBytes, (uint64_t)delta) + (uint64_t)delta;
+    if (delta > 0) {
+        mla_atomic_add(&item->totalBytes, (uint64_t)delta);
+        MlaPeak(&item->peakBytes, live);
+        MlaPeak(&mlaPeakBytes, total);
+    }
 }
 
-int MlaOutput(void)
+static uint8_t MlaSizeClass(uint32_t size)
 {
-#if CFG_MLA_FUNCTION && CFG_MLA_VERBOSE
-    uint8_t alignWidth = 128;
-#elif CFG_MLA_FUNCTION
+    return size > 1 ? 31 - __builtin_clz(size) : 0;
+}
+
+#if CFG_MLA_STACK
+/* 沿帧指针回溯，frame为对外接口自身的栈帧，第一帧即其调用者；帧地址须单调增长且间距合理，否则停止 */
+static uint32_t MlaStackWalk(void **frame, void **pc)
+{
+    uint32_t depth = 0;
+    while (depth < MLA_STACK_DEPTH && frame != NULL && frame[1] != NULL) {
+        pc[depth++] = frame[1];
+        void **next = (void **)frame[0];
+        if (next <= frame || (uintptr_t)next - (uintptr_t)frame > MLA_STACK_SPAN ||
+            ((uintptr_t)next & (sizeof(void *) - 1)) != 0) {
+            break;
+        }
+        frame = next;
+    }
+    return depth;
+}
+
+/* 查找或插入调用栈，返回编号；查找无锁，同一槽位只会被发布一次 */
+static uint32_t MlaStackId(void *frame)
+{
+    void *pc[MLA_STACK_DEPTH];
+    uint32_t depth = MlaStackWalk((void **)frame, pc);
+    if (depth == 0) {
+        return 0;
+    }
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < depth; i++) {
+        hash = (hash ^ (uint32_t)((uintptr_t)pc[i] ^ ((uint64_t)(uintptr_t)pc[i] >> 32))) * 16777619u;
+    }
+    for (uint32_t i = 0; i < MLA_STACK_PROBE; i++) {
+        uint32_t slot = (hash + i) & (MLA_STACK_SIZE - 1);
+        MlaStack_t *stack = &stackTable[slot];
+        uint32_t used = mla_atomic_load(&stack->depth);
+        if (used == 0) {
+            mla_lock(&stackLock);
+            used = stack->depth;
+            if (used == 0) {
+                stack->hash = hash;
+                memcpy(stack->frame, pc, depth * sizeof(void *));
+                mla_atomic_store(&stack->depth, depth);
+                mla_unlock(&stackLock);
+                return slot + 1;
+            }
+            mla_unlock(&stackLock);
+        }
+        if (used == depth && stack->hash == hash && memcmp(stack->frame, pc, depth * sizeof(void *)) == 0) {
+            return slot + 1;
+        }
+    }
+    mla_atomic_add(&stackDropped, 1);
+    return 0;
+}
+#endif
+
+#if CFG_MLA_LIVE_TABLE
+static void MlaLiveAdd(void *addr, Mla_t *item, uint32_t size, uint32_t stamp)
+{
+    uint32_t slot = MLA_LIVE_SLOT(addr);
+    for (uint16_t i = 0; i < MLA_LIVE_PROBE; i++) {
+        MlaLive_t *live = &liveTable[(slot + i) & (MLA_LIVE_SIZE - 1)];
+        void *expect = mla_atomic_load(&live->addr);
+        if ((expect == NULL || expect == MLA_LIVE_TOMB) && mla_atomic_cas(&live->addr, &expect, MLA_LIVE_BUSY)) {
+            live->item = item;
+            live->size = size;
+            live->stamp = stamp;
+            mla_atomic_store(&live->addr, addr);
+            return;
+        }
+    }
+    mla_atomic_add(&liveDropped, 1);
+}
+
+/* 需在内存真正释放前删除，否则同一地址被其他线程再次申请时会出现重复的键；stamp非空时带出申请时间 */
+static void MlaLiveDel(void *addr, uint32_t *stamp)
+{
+    uint32_t slot = MLA_LIVE_SLOT(addr);
+    for (uint16_t i = 0; i < MLA_LIVE_PROBE; i++) {
+        MlaLive_t *live = &liveTable[(slot + i) & (MLA_LIVE_SIZE - 1)];
+        void *key = mla_atomic_load(&live->addr);
+        if (key == addr) {
+            if (stamp != NULL) {
+                *stamp = live->stamp;
+            }
+            mla_atomic_store(&live->addr, MLA_LIVE_TOMB);
+            return;
+        }
+        if (key == NULL) {
+            return;
+        }
+    }
+}
+#endif
+
+/* 填写头部并记录本次申请，返回交给用户的地址；frame为对外接口的栈帧，只有被记录的申请才回溯调用栈
+ * 关闭记录时仍写入同样的头部，切换模式前后申请的内存可以互相释放 */
+static void *MlaTrack(MlaHead_t *head, uint32_t size, MlaSite_t *site, void *frame)
+{
+    int mode = mla_atomic_load(&mlaMode);
+    head->size = size;
+    // MlaDeinit之后记录器已释放，仍可申请释放但不做记录
+    if (mode == MLA_MODE_OFF || !mla_atomic_load(&mlaReady)) {
+        head->item = NULL;
+        head->flag = MLA_FLAG_TAG | MLA_FLAG_UNTRACKED;
+        return (uint8_t *)head + MEM_ID_SIZE;
+    }
+    head->flag = MLA_FLAG_TAG;
+#if CFG_MLA_SAMPLE
+    if (mode == MLA_MODE_SAMPLED) {
+        if (!MlaSampled(size)) {
+            head->item = NULL;
+            head->flag |= MLA_FLAG_UNTRACKED;
+            return (uint8_t *)head + MEM_ID_SIZE;
+        }
+        head->flag |= MLA_FLAG_SAMPLED;
+    }
+#endif
+#if CFG_MLA_LIFETIME
+    head->stamp = MlaTick();
+#endif
+#if CFG_MLA_STACK
+    head->item = MlaMallocRecorder(site, MlaStackId(frame));
+#else
+    UNUSED(frame);
+    head->item = MlaMallocRecorder(site, 0);
+#endif
+    if (head->item != NULL) {
+        mla_atomic_add(&mlaLiveBlocks, 1);
+        mla_atomic_add(&head->item->sizeClass[MlaSizeClass(size)], 1);
+        MlaBytesMove(head->item, MlaBytes(head->flag, size));
+#if CFG_MLA_SAMPLE
+        MlaSampleAdd(head->item, MLA_COUNT_MALLOC, head->flag, size);
+#endif
+#if CFG_MLA_LIVE_TABLE
+        MlaLiveAdd((uint8_t *)head + MEM_ID_SIZE, head->item, size, MlaClock());
+#endif
+    }
+    return (uint8_t *)head + MEM_ID_SIZE;
+}
+
+/* 申请内存时额外多申请MEM_ID_SIZE，用以存放调用点记录器地址，在free时无需查找即可统计申请释放次数 */
+static void *MlaAlloc(uint32_t size, MlaSite_t *site, void *frame)
+{
+    MlaHead_t *head = (MlaHead_t *)MLA_MALLOC(size + MEM_ID_SIZE);
+    if (head == NULL) {
+        LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+        return NULL;
+    }
+    head->offset = 0;
+    return MlaTrack(head, size, site, frame);
+}
+
+/* 对齐要求超过MLA_ALIGN时多申请alignment - MLA_ALIGN，头部紧贴对齐后的用户地址，偏移记录在头部用于找回实际申请地址 */
+static void *MlaAlign(uint32_t alignment, uint32_t size, MlaSite_t *site, void *frame)
+{
+    CHECK(alignment != 0 && (alignment & (alignment - 1)) == 0, NULL);
+    if (alignment <= MLA_ALIGN) {
+        return MlaAlloc(size, site, frame);
+    }
+    CHECK(alignment / MLA_ALIGN - 1 <= UINT16_MAX, NULL);
+    uint8_t *base = (uint8_t *)MLA_MALLOC(size + MEM_ID_SIZE + alignment - MLA_ALIGN);
+    if (base == NULL) {
+        LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+        return NULL;
+    }
+    uintptr_t addr = ((uintptr_t)base + MEM_ID_SIZE + alignment - 1) & ~((uintptr_t)alignment - 1);
+    MlaHead_t *head = MLA_HEAD(addr);
+    head->offset = ((uint8_t *)head - base) / MLA_ALIGN;
+    return MlaTrack(head, size, site, frame);
+}
+
+static void MlaRelease(void *addr, MlaSite_t *site)
+{
+    MlaHead_t *head = MLA_HEAD(addr);
+    if (head->flag & MLA_FLAG_UNTRACKED) {
+        MLA_FREE(MLA_BASE(head));
+        return;
+    }
+    Mla_t *item = head->item;
+    uint32_t size = head->size;
+    uint16_t flag = head->flag;
+#if CFG_MLA_LIFETIME
+    uint64_t stamp = head->stamp;
+#endif
+#if CFG_MLA_LIVE_TABLE
+    if (item != NULL) {
+        MlaLiveDel(addr, NULL);
+    }
+#endif
+    MLA_FREE(MLA_BASE(head));
+    MlaFreeRecorder(item, site);
+    if (item != NULL) {
+        mla_atomic_add(&mlaLiveBlocks, -1);
+        MlaBytesMove(item, -MlaBytes(flag, size));
+#if CFG_MLA_SAMPLE
+        MlaSampleAdd(item, MLA_COUNT_FREE, flag, size);
+#endif
+#if CFG_MLA_LIFETIME
+        MlaLifetimeAdd(item, stamp);
+#endif
+    }
+}
+
+void *MlaMalloc(uint32_t size, MlaSite_t *site)
+{
+    CHECK(site != NULL, NULL);
+    LOGD("%s - %s. Malloc caller %s:%u %s", __FILENAME__, __func__, site->file, site->line, site->func);
+    return MlaAlloc(size, site, __builtin_frame_address(0));
+}
+
+void MlaFree(void *addr, MlaSite_t *site)
+{
+    ASSERT(addr != NULL);
+    CHECK(site != NULL);
+    LOGD("%s - %s. Free caller %s:%u %s", __FILENAME__, __func__, site->file, site->line, site->func);
+    if (!MLA_TAGGED(addr)) {
+        LOGE("%s - %s. %p was not allocated by MLA", __FILENAME__, __func__, addr);
+        return;
+    }
+    MlaRelease(addr, site);
+}
+
+/* 以头部标记判断内存是否由MLA申请，供LD_PRELOAD拦截等混有其他来源内存的场景使用 */
+bool MlaOwned(void *addr)
+{
+    return addr != NULL && MLA_TAGGED(addr);
+}
+
+/* 申请时的大小，头部之后的这部分内存归用户使用；非MLA申请的内存返回0 */
+uint32_t MlaUsableSize(void *addr)
+{
+    if (addr == NULL || !MLA_TAGGED(addr)) {
+        return 0;
+    }
+    return MLA_HEAD(addr)->size;
+}
+
+void *MlaCalloc(uint32_t num, uint32_t size, MlaSite_t *site)
+{
+    CHECK(site != NULL, NULL);
+    LOGD("%s - %s. Calloc caller %s:%u %s", __FILENAME__, __func__, site->file, site->line, site->func);
+    if (num != 0 && size > UINT32_MAX / num) {
+        LOGE("%s - %s : %u. calloc overflow %u * %u", __FILENAME__, __func__, __LINE__, num, size);
+        return NULL;
+    }
+    void *addr = MlaAlloc(num * size, site, __builtin_frame_address(0));
+    if (addr != NULL) {
+        memset(addr, 0, num * size);
+    }
+    return addr;
+}
+
+/* realloc沿用原调用点的记录器，只更新头部、字节统计、存活表与采样权重中的大小，不计为一次释放加一次申请 */
+void *MlaRealloc(void *addr, uint32_t size, MlaSite_t *site)
+{
+    CHECK(site != NULL, NULL);
+    LOGD("%s - %s. Realloc caller %s:%u %s", __FILENAME__, __func__, site->file, site->line, site->func);
+    if (addr == NULL) {
+        return MlaAlloc(size, site, __builtin_frame_address(0));
+    }
+    if (!MLA_TAGGED(addr)) {
+        // 与MlaFree一样以头部标记识别，非MLA申请的内存交给系统realloc且不做记录
+        LOGW("%s - %s. %p was not allocated by MLA", __FILENAME__, __func__, addr);
+        return realloc(addr, size);
+    }
+    if (size == 0) {
+        MlaRelease(addr, site);
+        return NULL;
+    }
+    MlaHead_t *head = MLA_HEAD(addr);
+    uint32_t oldSize = head->size;
+    uint16_t flag = head->flag;
+    Mla_t *item = (flag & MLA_FLAG_UNTRACKED) ? NULL : head->item;
+#if CFG_MLA_LIVE_TABLE
+    uint32_t stamp = MlaClock();
+    if (item != NULL) {
+        MlaLiveDel(addr, &stamp);
+    }
+#endif
+    MlaHead_t *newHead = NULL;
+    if (head->offset == 0) {
+        newHead = (MlaHead_t *)MLA_REALLOC(head, size + MEM_ID_SIZE);
+    } else {
+        /* 对齐申请的内存无法交给MLA_REALLOC，按普通对齐重新申请后拷贝 */
+        newHead = (MlaHead_t *)MLA_MALLOC(size + MEM_ID_SIZE);
+        if (newHead != NULL) {
+            memcpy(newHead, head, MEM_ID_SIZE + (oldSize < size ? oldSize : size));
+            newHead->offset = 0;
+            MLA_FREE(MLA_BASE(head));
+        }
+    }
+    if (newHead == NULL) {
+        LOGE("%s - %s : %u. realloc fail!", __FILENAME__, __func__, __LINE__);
+#if CFG_MLA_LIVE_TABLE
+        if (item != NULL) {
+            MlaLiveAdd(addr, item, oldSize, stamp);
+        }
+#endif
+        return NULL;
+    }
+    newHead->size = size;
+    if (item != NULL) {
+        MlaBytesMove(item, MlaBytes(flag, size) - MlaBytes(flag, oldSize));
+#if CFG_MLA_SAMPLE
+        if (flag & MLA_FLAG_SAMPLED) {
+            MlaSampleMove(item, oldSize, size);
+        }
+#endif
+    }
+#if CFG_MLA_LIVE_TABLE
+    if (item != NULL) {
+        MlaLiveAdd((uint8_t *)newHead + MEM_ID_SIZE, item, size, stamp);
+    }
+#endif
+    return (uint8_t *)newHead + MEM_ID_SIZE;
+}
+
+void *MlaAlignedAlloc(uint32_t alignment, uint32_t size, MlaSite_t *site)
+{
+    CHECK(site != NULL, NULL);
+    LOGD("%s - %s. Aligned alloc caller %s:%u %s", __FILENAME__, __func__, site->file, site->line, site->func);
+    return MlaAlign(alignment, size, site, __builtin_frame_address(0));
+}
+
+int MlaPosixMemalign(void **memptr, uint32_t alignment, uint32_t size, MlaSite_t *site)
+{
+    CHECK(memptr != NULL, EINVAL);
+    CHECK(site != NULL, EINVAL);
+    LOGD("%s - %s. Memalign caller %s:%u %s", __FILENAME__, __func__, site->file, site->line, site->func);
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *addr = MlaAlign(alignment, size, site, __builtin_frame_address(0));
+    if (addr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = addr;
+    return 0;
+}
+
+#if CFG_MLA_VERBOSE
+static int MlaCollectVerboseInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    CHECK(*p_arg != NULL, -1);
+    VerbosePrintInfo_t *printInfo = (VerbosePrintInfo_t *)(*p_arg);
+    MlaFreeInfo_t *recorder = (MlaFreeInfo_t *)(*p_node);
+    char bufMalloc[32] = {0};
+    if (printInfo->verboseIndex == 1) {
+        MLA_OUTPUT("%s", SplitLine);
+        MLA_OUTPUT("|""%-16s%-32s%-*s""|", "Verbose:", "malloc", BUFFER_SIZE, "free");
+        snprintf(bufMalloc, sizeof(bufMalloc) - 1, "(%llu)B - [%u]", (unsigned long long)printInfo->mla.totalBytes,
+            printInfo->mla.mallocCount);
+    }
+    char bufFree[BUFFER_SIZE] = {0};
+#if CFG_MLA_FUNCTION
+    snprintf(bufFree, sizeof(bufFree) - 1, "%s:%u %s - [%u]", recorder->file, recorder->line, recorder->func,
+        mla_atomic_load(&recorder->freeCount));
+#else
+    snprintf(bufFree, sizeof(bufFree) - 1, "%s:%u - [%u]", recorder->file, recorder->line, mla_atomic_load(&recorder->freeCount));
+#endif
+    MLA_OUTPUT("|""%3u.%-12s%-32s%-*s""|", printInfo->verboseIndex, "", bufMalloc, BUFFER_SIZE, bufFree);
+    printInfo->verboseIndex++;
+
+    return 0;
+}
+#endif
+
+/* 输出时锁内只复制记录器指针，格式化在锁外进行；记录器在MlaReset前不会释放，计数字段均为原子读取 */
+typedef struct {
+    Mla_t **item;
+    uint32_t count;
+} MlaRows_t;
+
+static int MlaCollectRow(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    MlaRows_t *rows = (MlaRows_t *)(*p_arg);
+    if (rows->item != NULL) {
+        rows->item[rows->count] = (Mla_t *)(*p_node);
+    }
+    rows->count++;
+    return 0;
+}
+
+/* 缓冲在锁外申请，期间新增了调用点则按新的个数重新申请，与MlaSnapshotBuild相同 */
+static int MlaRowsBuild(MlaRows_t *rows)
+{
+    uint32_t size = 0;
+    rows->item = NULL;
+    for (;;) {
+        mla_lock(&recorderLock);
+        Mla_t **item = rows->item;
+        rows->item = NULL;
+        rows->count = 0;
+        mla_slist_foreach(&recorderList, MlaCollectRow, rows);
+        rows->item = item;
+        if (item != NULL && rows->count <= size) {
+            break;
+        }
+        mla_unlock(&recorderLock);
+        if (item != NULL) {
+            MLA_FREE(item);
+        }
+        size = rows->count;
+        rows->item = (Mla_t **)MLA_MALLOC(sizeof(Mla_t *) * (size ? size : 1));
+        if (rows->item == NULL) {
+            LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+            return -1;
+        }
+    }
+    rows->count = 0;
+    mla_slist_foreach(&recorderList, MlaCollectRow, rows);
+    mla_unlock(&recorderLock);
+    return 0;
+}
+
+static void MlaRowsForeach(MlaRows_t *rows, slist_node_process_t process, void *arg)
+{
+    for (uint32_t i = 0; i < rows->count; i++) {
+        mla_list_node_t *node = &rows->item[i]->node;
+        process(&arg, &node);
+    }
+}
+
+/* 先读释放次数再读申请次数，并发申请释放时差值不会出现负数 */
+static bool MlaVisible(Mla_t *recorder, uint32_t *mallocCount, uint32_t *freeCount)
+{
+    *freeCount = mla_atomic_load(&recorder->freeCount);
+    *mallocCount = mla_atomic_load(&recorder->mallocCount);
+#if MLA_MONITOR_INFO
+    return true;
+#else
+    // 分配与释放次数一致的记录器不在内存泄漏检查表中显示
+    return *mallocCount != *freeCount;
+#endif
+}
+
+static int MlaCountInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    uint32_t mallocCount, freeCount;
+    if (MlaVisible((Mla_t *)(*p_node), &mallocCount, &freeCount)) {
+        (*(uint16_t *)(*p_arg))++;
+    }
+    return 0;
+}
+
+static int MlaStatInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    uint32_t *stat = (uint32_t *)(*p_arg);
+    uint32_t mallocCount, freeCount;
+    MlaVisible((Mla_t *)(*p_node), &mallocCount, &freeCount);
+    stat[0] += mallocCount;
+    stat[1] += freeCount;
+    return 0;
+}
+
+static int MlaCollectInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+
+    char buf[BUFFER_SIZE] = {0};
+    Mla_t *recorder = (Mla_t *)(*p_node);
+    uint32_t mallocCount, freeCount;
+    if (!MlaVisible(recorder, &mallocCount, &freeCount)) {
+        return 0;
+    }
+#if CFG_MLA_FUNCTION
+    snprintf(buf, sizeof(buf) - 1 , "%s:%u %s", recorder->file, recorder->line, recorder->func);
+#else
+    snprintf(buf, sizeof(buf) - 1, "%s: %u", recorder->file, recorder->line);
+#endif
+    if (*p_arg != NULL && *((bool *)(*p_arg))) {
+        MLA_OUTPUT(" ""%-*s%-16u%-16u%-16u%d", BUFFER_SIZE - 10, buf, recorder->site->id, mallocCount, freeCount,
+            mallocCount - freeCount);
+        return 0;
+    }
+#if CFG_MLA_VERBOSE
+    MLA_OUTPUT(">%u", ++mlaIndex);
+    MLA_OUTPUT(" ""%-*s%-16s%-16s%-16s%s", BUFFER_SIZE - 10, "Caller", "Live", "Malloc", "Free", "Diff");
+    MLA_OUTPUT(" ""%-*s%-16llu%-16u%-16u%d", BUFFER_SIZE - 10, buf,
+        (unsigned long long)mla_atomic_load(&recorder->liveBytes), mallocCount, freeCount, mallocCount - freeCount);
+    VerbosePrintInfo_t printInfo;
+    printInfo.verboseIndex = 1;
+    printInfo.mla.totalBytes = mla_atomic_load(&recorder->totalBytes);  // 只用到这两项，锁外不整体复制正在更新的记录器
+    printInfo.mla.mallocCount = mallocCount;
+    mla_lock(&shardLock[MLA_SHARD(recorder->hash)]);
+    mla_slist_foreach(&recorder->freeInfo, MlaCollectVerboseInfo, &printInfo);
+    mla_unlock(&shardLock[MLA_SHARD(recorder->hash)]);
+    MLA_OUTPUT("%s", SplitLine);
+#endif
+
+    return 0;
+}
+
+/* MLA自身记录占用的内存，Reserved为slab已向系统申请的大小，Used为正在使用的部分 */
+static void MlaOutputMetadata(void)
+{
+    uint32_t reserved = mla_slab_reserved_get(&recorderSlab);
+    uint32_t used = mla_slab_used_get(&recorderSlab);
+    MLA_OUTPUT("\r\n"" ""%-*s%-16s%s", BUFFER_SIZE - 10, "Metadata", "Reserved", "Used");
+    MLA_OUTPUT(" ""%-*s%-16u%u", BUFFER_SIZE - 10, "recorder", mla_slab_reserved_get(&recorderSlab),
+        mla_slab_used_get(&recorderSlab));
+#if CFG_MLA_VERBOSE
+    reserved += mla_slab_reserved_get(&freeInfoSlab);
+    used += mla_slab_used_get(&freeInfoSlab);
+    MLA_OUTPUT(" ""%-*s%-16u%u", BUFFER_SIZE - 10, "free site", mla_slab_reserved_get(&freeInfoSlab),
+        mla_slab_used_get(&freeInfoSlab));
+#endif
+#if CFG_MLA_THREAD_CACHE
+    reserved += mla_slab_reserved_get(&cacheSlab);
+    used += mla_slab_used_get(&cacheSlab);
+    MLA_OUTPUT(" ""%-*s%-16u%u", BUFFER_SIZE - 10, "thread cache", mla_slab_reserved_get(&cacheSlab),
+        mla_slab_used_get(&cacheSlab));
+#endif
+    MLA_OUTPUT(" ""%-*s%-16u%u", BUFFER_SIZE - 10, "total", reserved, used);
+}
+
+/* 各级以下限表示，如"4K:3"为3次大小在[4K, 8K)内的申请 */
+static void MlaSizeClassString(Mla_t *recorder, char *buf, uint32_t len)
+{
+    static const char unit[] = {'\0', 'K', 'M', 'G'};
+    uint32_t used = 0;
+    buf[0] = '\0';
+    for (uint8_t i = 0; i < MLA_SIZE_CLASSES && used < len; i++) {
+        uint32_t count = mla_atomic_load(&recorder->sizeClass[i]);
+        if (count != 0) {
+            used += snprintf(buf + used, len - used, "%s%u%.1s:%u", used ? " " : "", 1u << (i % 10), &unit[i / 10], count);
+        }
+    }
+}
+
+static int MlaCollectBytesInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    UNUSED(*p_arg);
+    Mla_t *recorder = (Mla_t *)(*p_node);
+    uint32_t mallocCount, freeCount;
+    if (!MlaVisible(recorder, &mallocCount, &freeCount)) {
+        return 0;
+    }
+    char buf[BUFFER_SIZE] = {0};
+    char sizes[128] = {0};
+#if CFG_MLA_FUNCTION
+    snprintf(buf, sizeof(buf) - 1 , "%s:%u %s", recorder->file, recorder->line, recorder->func);
+#else
+    snprintf(buf, sizeof(buf) - 1, "%s: %u", recorder->file, recorder->line);
+#endif
+    MlaSizeClassString(recorder, sizes, sizeof(sizes));
+    MLA_OUTPUT(" ""%-*s%-16llu%-16llu%-16llu%s", BUFFER_SIZE - 10, buf,
+        (unsigned long long)mla_atomic_load(&recorder->liveBytes), (unsigned long long)mla_atomic_load(&recorder->peakBytes),
+        (unsigned long long)mla_atomic_load(&recorder->totalBytes), sizes);
+    return 0;
+}
+
+/* 按字节统计，Peak为各自存活字节数的历史最大值，process行为全部调用点之和的当前值与最大值 */
+static void MlaOutputBytes(MlaRows_t *rows)
+{
+    MLA_OUTPUT("\r\n"" ""%-*s%-16s%-16s%-16s%s", BUFFER_SIZE - 10, "Bytes", "Live", "Peak", "Total", "Sizes");
+    MlaRowsForeach(rows, MlaCollectBytesInfo, NULL);
+    MLA_OUTPUT(" ""%-*s%-16llu%llu", BUFFER_SIZE - 10, "process", (unsigned long long)mla_atomic_load(&mlaLiveBytes),
+        (unsigned long long)mla_atomic_load(&mlaPeakBytes));
+}
+
+#if CFG_MLA_LIVE_TABLE
+typedef struct {
+    MlaLive_t *live;
+    uint32_t count;
+    uint32_t now;
+} MlaLiveInfo_t;
+
+static int MlaLiveCompare(const void *a, const void *b)
+{
+    const MlaLive_t *x = (const MlaLive_t *)a;
+    const MlaLive_t *y = (const MlaLive_t *)b;
+    if (x->item != y->item) {
+        return (uintptr_t)x->item < (uintptr_t)y->item ? -1 : 1;
+    }
+    return x->stamp < y->stamp ? -1 : x->stamp > y->stamp;
+}
+
+static int MlaCollectLiveInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    MlaLiveInfo_t *info = (MlaLiveInfo_t *)(*p_arg);
+    Mla_t *recorder = (Mla_t *)(*p_node);
+    // 按记录器地址二分查找，同一记录器的存活块已按申请时间排序
+    uint32_t low = 0, high = info->count;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if ((uintptr_t)info->live[mid].item < (uintptr_t)recorder) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    char buf[BUFFER_SIZE] = {0};
+    char addr[24] = {0};
+#if CFG_MLA_FUNCTION
+    snprintf(buf, sizeof(buf) - 1 , "%s:%u %s", recorder->file, recorder->line, recorder->func);
+#else
+    snprintf(buf, sizeof(buf) - 1, "%s: %u", recorder->file, recorder->line);
+#endif
+    for (uint32_t i = low; i < info->count && i < low + MLA_LIVE_OLDEST && info->live[i].item == recorder; i++) {
+        snprintf(addr, sizeof(addr) - 1, "%p", info->live[i].addr);
+        MLA_OUTPUT(" ""%-*s%-16s%-16u%u", BUFFER_SIZE - 10, i == low ? buf : "", addr, info->live[i].size,
+            info->now - info->live[i].stamp);
+    }
+    return 0;
+}
+
+/* 复制当前存活块后按记录器和申请时间排序，输出各调用点最早未释放的内存 */
+static void MlaOutputLive(MlaRows_t *rows)
+{
+    MlaLiveInfo_t info = {NULL, 0, MlaClock()};
+    info.live = (MlaLive_t *)MLA_MALLOC(sizeof(MlaLive_t) * MLA_LIVE_SIZE);
+    if (info.live == NULL) {
+        LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+        return;
+    }
+    for (uint32_t i = 0; i < MLA_LIVE_SIZE; i++) {
+        void *addr = mla_atomic_load(&liveTable[i].addr);
+        if (addr != NULL && addr != MLA_LIVE_TOMB && addr != MLA_LIVE_BUSY) {
+            info.live[info.count] = liveTable[i];
+            info.live[info.count++].addr = addr;
+        }
+    }
+    qsort(info.live, info.count, sizeof(MlaLive_t), MlaLiveCompare);
+    MLA_OUTPUT("\r\n"" ""%-*s%-16s%-16s%s", BUFFER_SIZE - 10, "Live", "Address", "Size", "Age(ms)");
+    MlaRowsForeach(rows, MlaCollectLiveInfo, &info);
+    if (mla_atomic_load(&liveDropped) != 0) {
+        MLA_OUTPUT(" ""%-*s%u", BUFFER_SIZE - 10, "untracked", mla_atomic_load(&liveDropped));
+    }
+    MLA_FREE(info.live);
+}
+#endif
+
+#if CFG_MLA_SAMPLE
+/* 按采样权重放大的估计值，Diff后为95%置信区间的半宽；只输出有被采样内存的调用点 */
+static int MlaCollectSampleInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    UNUSED(*p_arg);
+    Mla_t *recorder = (Mla_t *)(*p_node);
+    char buf[BUFFER_SIZE] = {0};
+    char diff[32] = {0};
+#if CFG_MLA_FUNCTION
+    snprintf(buf, sizeof(buf) - 1 , "%s:%u %s", recorder->file, recorder->line, recorder->func);
+#else
+    snprintf(buf, sizeof(buf) - 1, "%s: %u", recorder->file, recorder->line);
+#endif
+    uint64_t mallocSum = mla_atomic_load(&recorder->weight[MLA_COUNT_MALLOC]);
+    uint64_t freeSum = mla_atomic_load(&recorder->weight[MLA_COUNT_FREE]);
+    if (mallocSum == 0 && freeSum == 0) {
+        return 0;  // 没有被采样的内存
+    }
+    double mallocWeight = (double)mallocSum / MLA_WEIGHT_SCALE;
+    double freeWeight = (double)freeSum / MLA_WEIGHT_SCALE;
+    double variance = (double)(int64_t)(mla_atomic_load(&recorder->variance[MLA_COUNT_MALLOC]) -
+        mla_atomic_load(&recorder->variance[MLA_COUNT_FREE]));
+    snprintf(diff, sizeof(diff) - 1, "%.0f +/- %.0f", mallocWeight - freeWeight, 1.96 * sqrt(variance > 0 ? variance : 0));
+    MLA_OUTPUT(" ""%-*s%-16.0f%-16.0f%s", BUFFER_SIZE - 10, buf, mallocWeight, freeWeight, diff);
+    return 0;
+}
+
+static void MlaOutputSample(MlaRows_t *rows)
+{
+    char title[32] = {0};
+    snprintf(title, sizeof(title) - 1, "Sampled(1/%uB)", MLA_SAMPLE_RATE);
+    MLA_OUTPUT("\r\n"" ""%-*s%-16s%-16s%s", BUFFER_SIZE - 10, title, "~Malloc", "~Free", "~Diff");
+    MlaRowsForeach(rows, MlaCollectSampleInfo, NULL);
+}
+#endif
+
+#if CFG_MLA_LIFETIME
+/* 以所在级的上限表示时长 */
+static void MlaLifetimeString(uint8_t index, char *buf, uint32_t len)
+{
+    uint64_t bound = 2ull << index;
+    if (index == MLA_LIFETIME_CLASSES - 1) {
+        snprintf(buf, len, ">%llus", (unsigned long long)(bound / 2 / 1000000));
+    } else if (bound < 1000) {
+        snprintf(buf, len, "<%lluus", (unsigned long long)bound);
+    } else if (bound < 1000000) {
+        snprintf(buf, len, "<%llums", (unsigned long long)(bound / 1000));
+    } else {
+        snprintf(buf, len, "<%llus", (unsigned long long)(bound / 1000000));
+    }
+}
+
+/* 按分布估计的分位数，如P90为<2ms表示九成已释放的内存存活不足2ms；只统计已释放的内存 */
+static int MlaCollectLifetimeInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    UNUSED(*p_arg);
+    static const uint8_t percent[] = {50, 90, 99};
+    Mla_t *recorder = (Mla_t *)(*p_node);
+    uint32_t lifetime[MLA_LIFETIME_CLASSES];
+    uint64_t freed = 0;
+    uint8_t last = 0;
+    for (uint8_t i = 0; i < MLA_LIFETIME_CLASSES; i++) {
+        lifetime[i] = mla_atomic_load(&recorder->lifetime[i]);
+        freed += lifetime[i];
+        last = lifetime[i] != 0 ? i : last;
+    }
+    if (freed == 0) {
+        return 0;
+    }
+    char buf[BUFFER_SIZE] = {0};
+    char value[4][16] = {{0}};
+#if CFG_MLA_FUNCTION
+    snprintf(buf, sizeof(buf) - 1 , "%s:%u %s", recorder->file, recorder->line, recorder->func);
+#else
+    snprintf(buf, sizeof(buf) - 1, "%s: %u", recorder->file, recorder->line);
+#endif
+    uint64_t sum = 0;
+    uint8_t index = 0;
+    for (uint8_t i = 0; i < sizeof(percent); i++) {
+        while (sum + lifetime[index] < (freed * percent[i] + 99) / 100) {
+            sum += lifetime[index++];
+        }
+        MlaLifetimeString(index, value[i], sizeof(value[i]));
+    }
+    MlaLifetimeString(last, value[3], sizeof(value[3]));
+    MLA_OUTPUT(" ""%-*s%-16llu%-16s%-16s%-16s%s", BUFFER_SIZE - 10, buf, (unsigned long long)freed, value[0], value[1],
+        value[2], value[3]);
+    return 0;
+}
+
+static void MlaOutputLifetime(MlaRows_t *rows)
+{
+    MLA_OUTPUT("\r\n"" ""%-*s%-16s%-16s%-16s%-16s%s", BUFFER_SIZE - 10, "Lifetime", "Freed", "P50", "P90", "P99", "Max");
+    MlaRowsForeach(rows, MlaCollectLifetimeInfo, NULL);
+}
+#endif
+
+#if CFG_MLA_STACK
+/* 只解析存在泄漏的记录器的调用栈，未导出的符号以模块内偏移显示(可执行文件需以-rdynamic链接) */
+static int MlaCollectStackInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    UNUSED(*p_arg);
+    Mla_t *recorder = (Mla_t *)(*p_node);
+    uint32_t mallocCount, freeCount;
+    if (recorder->stack == 0 || !MlaVisible(recorder, &mallocCount, &freeCount) || mallocCount == freeCount) {
+        return 0;
+    }
+    char buf[BUFFER_SIZE] = {0};
+#if CFG_MLA_FUNCTION
+    snprintf(buf, sizeof(buf) - 1 , "%s:%u %s", recorder->file, recorder->line, recorder->func);
+#else
+    snprintf(buf, sizeof(buf) - 1, "%s: %u", recorder->file, recorder->line);
+#endif
+    MLA_OUTPUT(" ""%-*s%d", BUFFER_SIZE - 10, buf, mallocCount - freeCount);
+    MlaStack_t *stack = &stackTable[recorder->stack - 1];
+    for (uint32_t i = 0; i < stack->depth; i++) {
+        Dl_info info;
+        if (dladdr(stack->frame[i], &info) == 0 || info.dli_fname == NULL) {
+            MLA_OUTPUT("    #%u %p", i, stack->frame[i]);
+            continue;
+        }
+        const char *module = strrchr(info.dli_fname, '/') ? strrchr(info.dli_fname, '/') + 1 : info.dli_fname;
+        if (info.dli_sname != NULL) {
+            MLA_OUTPUT("    #%u %p %s+0x%lx (%s)", i, stack->frame[i], info.dli_sname,
+                (unsigned long)((uintptr_t)stack->frame[i] - (uintptr_t)info.dli_saddr), module);
+        } else {
+            MLA_OUTPUT("    #%u %p (%s+0x%lx)", i, stack->frame[i], module,
+                (unsigned long)((uintptr_t)stack->frame[i] - (uintptr_t)info.dli_fbase));
+        }
+    }
+    return 0;
+}
+
+static void MlaOutputStack(MlaRows_t *rows)
+{
+    MLA_OUTPUT("\r\n"" ""%-*s%s", BUFFER_SIZE - 10, "Stack", "Diff");
+    MlaRowsForeach(rows, MlaCollectStackInfo, NULL);
+    if (mla_atomic_load(&stackDropped) != 0) {
+        MLA_OUTPUT(" ""%-*s%u", BUFFER_SIZE - 10, "untracked", mla_atomic_load(&stackDropped));
+    }
+}
+#endif
+
+#if CFG_MLA_POOL
+/* 内存池各级占用，Frag为已用块中未被申请者使用的比例(内部碎片)，Idle为已切分但空闲的字节，large为超出最大一级的块 */
+static void MlaOutputPool(void)
+{
+    pool_stat_t stat;
+    char buf[32] = {0};
+    MLA_OUTPUT("\r\n"" ""%-*s%-16s%-16s%-16s%-16s%s", BUFFER_SIZE - 10, "Pool", "Block", "Used/Total", "Peak", "Idle", "Frag");
+    for (uint8_t i = 0; pool_stat_get(i, &stat) == 0; i++) {
+        if (stat.total == 0) {
+            continue;
+        }
+        if (stat.block_size == 0) {  // 超出最大一级，直接由系统分配，不占用arena
+            MLA_OUTPUT(" ""%-*s%-16s%-16u%-16u%-16u%s", BUFFER_SIZE - 10, "large", "system", stat.used, stat.peak, 0, "-");
+            continue;
+        }
+        uint32_t usedBytes = stat.used * stat.block_size;
+        snprintf(buf, sizeof(buf) - 1, "%u/%u", stat.used, stat.total);
+        MLA_OUTPUT(" ""%-*s%-16u%-16s%-16u%-16u%u%%", BUFFER_SIZE - 10, "class", stat.block_size, buf, stat.peak,
+            (stat.total - stat.used) * stat.block_size, usedBytes ? (usedBytes - stat.requested) * 100 / usedBytes : 0);
+    }
+    MLA_OUTPUT(" ""%-*s%u", BUFFER_SIZE - 10, "arena free", pool_arena_free_get());
+}
+#endif
+
+typedef struct {
+    snapshot_site_t *site;
+    char *string;
+    uint32_t count;
+    uint32_t stringSize;
+} MlaSnapshotInfo_t;
+
+static uint32_t MlaSnapshotString(MlaSnapshotInfo_t *info, const char *str)
+{
+    uint32_t offset = info->stringSize;
+    uint32_t len = strlen(str) + 1;
+    if (info->string != NULL) {
+        memcpy(info->string + offset, str, len);
+    }
+    info->stringSize += len;
+    return offset;
+}
+
+#if CFG_MLA_STACK
+/* 调用栈以"模块名+模块内偏移"表示，不受地址随机化影响，同一程序的两次运行可以对应；无法解析的栈帧保留原地址 */
+static void MlaStackString(uint32_t id, char *buf, uint32_t len)
+{
+    uint32_t used = 0;
+    buf[0] = '\0';
+    if (id == 0) {
+        return;
+    }
+    MlaStack_t *stack = &stackTable[id - 1];
+    for (uint32_t i = 0; i < stack->depth && used < len; i++) {
+        Dl_info info;
+        int ret;
+        if (dladdr(stack->frame[i], &info) == 0 || info.dli_fname == NULL) {
+            ret = snprintf(buf + used, len - used, "%s%p", i ? " " : "", stack->frame[i]);
+        } else {
+            const char *module = strrchr(info.dli_fname, '/') ? strrchr(info.dli_fname, '/') + 1 : info.dli_fname;
+            ret = snprintf(buf + used, len - used, "%s%s+0x%lx", i ? " " : "", module,
+                (unsigned long)((uintptr_t)stack->frame[i] - (uintptr_t)info.dli_fbase));
+        }
+        used += ret > 0 ? ret : 0;
+    }
+}
+#endif
+
+/* site为NULL时只统计记录器个数与字符串表大小，之后再按同样顺序填充 */
+static int MlaCollectSnapshotInfo(void **p_arg, mla_list_node_t **p_node)
+{
+    CHECK(*p_node != NULL, -1);
+    CHECK(*p_arg != NULL, -1);
+    MlaSnapshotInfo_t *info = (MlaSnapshotInfo_t *)(*p_arg);
+    Mla_t *recorder = (Mla_t *)(*p_node);
+#if CFG_MLA_FUNCTION
+    const char *func = recorder->func;
+#else
+    const char *func = "";
+#endif
+    char stack[MLA_STACK_TEXT_SIZE] = {0};
+#if CFG_MLA_STACK
+    MlaStackString(recorder->stack, stack, sizeof(stack));
+#endif
+    if (info->site == NULL) {
+        info->count++;
+        MlaSnapshotString(info, recorder->file);
+        MlaSnapshotString(info, func);
+        MlaSnapshotString(info, stack);
+        return 0;
+    }
+    snapshot_site_t *site = &info->site[info->count++];
+    memset(site, 0, sizeof(snapshot_site_t));
+    site->free_count = mla_atomic_load(&recorder->freeCount);
+    site->malloc_count = mla_atomic_load(&recorder->mallocCount);
+    site->file = MlaSnapshotString(info, recorder->file);
+    site->func = MlaSnapshotString(info, func);
+    site->stack = MlaSnapshotString(info, stack);
+    site->line = recorder->line;
+    site->live_bytes = mla_atomic_load(&recorder->liveBytes);
+    site->peak_bytes = mla_atomic_load(&recorder->peakBytes);
+    site->total_bytes = mla_atomic_load(&recorder->totalBytes);
+    return 0;
+}
+
+/* 将全部记录器复制为snapshot.h定义的格式，锁内只做复制；缓冲在锁外申请，期间新增了调用点则按新的大小重新申请 */
+static uint8_t *MlaSnapshotBuild(uint32_t *p_total)
+{
+    MlaSnapshotInfo_t info = {NULL, NULL, 0, 0};
+    uint8_t *buf = NULL;
+    uint32_t size = 0;
+#if CFG_MLA_THREAD_CACHE
+    MlaCacheFlush();
+#endif
+    for (;;) {
+        // 两次遍历期间持有recorderLock，记录器个数不会变化
+        mla_lock(&recorderLock);
+        info.count = 0;
+        info.stringSize = 0;
+        mla_slist_foreach(&recorderList, MlaCollectSnapshotInfo, &info);
+        uint32_t need = sizeof(snapshot_head_t) + info.count * sizeof(snapshot_site_t) + info.stringSize;
+        if (buf != NULL && need <= size) {
+            break;
+        }
+        mla_unlock(&recorderLock);
+        if (buf != NULL) {
+            MLA_FREE(buf);
+        }
+        size = need;
+        buf = (uint8_t *)MLA_MALLOC(size);
+        if (buf == NULL) {
+            LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+            return NULL;
+        }
+    }
+    uint32_t stringOffset = sizeof(snapshot_head_t) + info.count * sizeof(snapshot_site_t);
+    info.site = (snapshot_site_t *)(buf + sizeof(snapshot_head_t));
+    info.string = (char *)buf + stringOffset;
+    info.count = 0;
+    info.stringSize = 0;
+    mla_slist_foreach(&recorderList, MlaCollectSnapshotInfo, &info);
+    mla_unlock(&recorderLock);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    snapshot_head_t *head = (snapshot_head_t *)buf;
+    memset(head, 0, sizeof(snapshot_head_t));
+    head->magic = SNAPSHOT_MAGIC;
+    head->version = SNAPSHOT_VERSION;
+    head->head_size = sizeof(snapshot_head_t);
+    head->site_size = sizeof(snapshot_site_t);
+    head->site_count = info.count;
+    head->string_offset = stringOffset;
+    head->string_size = info.stringSize;
+    head->time_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    head->live_bytes = mla_atomic_load(&mlaLiveBytes);
+    head->peak_bytes = mla_atomic_load(&mlaPeakBytes);
+    *p_total = stringOffset + info.stringSize;
+    return buf;
+}
+
+/* 将全部记录器以snapshot.h定义的二进制格式一次写入文件，可用tools/mla_diff比较两次快照 */
+int MlaSnapshot(const char *path)
+{
+    CHECK(path != NULL, -1);
+    uint32_t total = 0;
+    uint8_t *buf = MlaSnapshotBuild(&total);
+    if (buf == NULL) {
+        return -1;
+    }
+    int ret = -1;
+    FILE *file = fopen(path, "wb");
+    if (file != NULL) {
+        ret = fwrite(buf, total, 1, file) == 1 ? 0 : -1;
+        ret = fclose(file) == 0 ? ret : -1;
+    }
+    if (ret != 0) {
+        LOGE("%s - %s. write %s fail", __FILENAME__, __func__, path);
+    }
+    MLA_FREE(buf);
+    return ret;
+}
+
+#if CFG_MLA_REPORTER
+/* 由复制出的快照格式化输出，不持有任何锁；各调用点先读释放次数再读申请次数，Diff不会为负 */
+static void MlaReport(void)
+{
+    uint32_t total = 0;
+    uint8_t *buf = MlaSnapshotBuild(&total);
+    if (buf == NULL) {
+        return;
+    }
+    snapshot_head_t *head = (snapshot_head_t *)buf;
+    snapshot_site_t *site = (snapshot_site_t *)(buf + head->head_size);
+    const char *string = (const char *)buf + head->string_offset;
+    char caller[BUFFER_SIZE] = {0};
+    MLA_OUTPUT("\r\n"" ""%-*s%-16s%-16s%-16s%-16s%s", BUFFER_SIZE - 10, "Report", "Malloc", "Free", "Diff", "Live", "Peak");
+    for (uint32_t i = 0; i < head->site_count; i++, site++) {
+#if !MLA_MONITOR_INFO
+        if (site->malloc_count == site->free_count) {
+            continue;
+        }
+#endif
+        snprintf(caller, sizeof(caller) - 1, "%s:%u %s", string + site->file, site->line, string + site->func);
+        MLA_OUTPUT(" ""%-*s%-16u%-16u%-16d%-16llu%llu", BUFFER_SIZE - 10, caller, site->malloc_count, site->free_count,
+            site->malloc_count - site->free_count, (unsigned long long)site->live_bytes,
+            (unsigned long long)site->peak_bytes);
+    }
+    MLA_OUTPUT(" ""%-*s%-16s%-16s%-16s%-16llu%llu", BUFFER_SIZE - 10, "process", "", "", "",
+        (unsigned long long)head->live_bytes, (unsigned long long)head->peak_bytes);
+    MLA_FREE(buf);
+}
+
+static int MlaReportPost(void)
+{
+    return mla_atomic_load(&reporterReady) ? sem_post(&reportSem) : -1;
+}
+
+/* 信号处理函数只调用异步信号安全的sem_post，并保留被打断线程的errno */
+static void MlaReportSignal(int signo)
+{
+    UNUSED(signo);
+    int err = errno;
+    MlaReportPost();
+    errno = err;
+}
+
+static void *MlaReporter(void *arg)
+{
+    UNUSED(arg);
+    while (!mla_atomic_load(&reporterStop)) {
+#if MLA_REPORT_PERIOD
+        struct timespec due;
+        clock_gettime(CLOCK_REALTIME, &due);
+        due.tv_sec += MLA_REPORT_PERIOD / 1000 + (due.tv_nsec + MLA_REPORT_PERIOD % 1000 * 1000000) / 1000000000;
+        due.tv_nsec = (due.tv_nsec + MLA_REPORT_PERIOD % 1000 * 1000000) % 1000000000;
+        int ret = sem_timedwait(&reportSem, &due);
+#else
+        int ret = sem_wait(&reportSem);
+#endif
+        if ((ret != 0 && errno == EINTR) || mla_atomic_load(&reporterStop)) {
+            continue;
+        }
+        // 合并输出期间积压的请求
+        while (sem_trywait(&reportSem) == 0) {
+        }
+        if (mla_atomic_load(&mlaReady)) {
+            MlaReport();
+        }
+    }
+    return NULL;
+}
+
+static void MlaReporterStart(void)
+{
+    if (mla_atomic_load(&reporterReady)) {
+        return;
+    }
+    CHECK(sem_init(&reportSem, 0, 0) == 0);
+    mla_atomic_store(&reporterStop, false);
+    if (pthread_create(&reporter, NULL, MlaReporter, NULL) != 0) {
+        LOGE("%s - %s : %u. create reporter fail!", __FILENAME__, __func__, __LINE__);
+        sem_destroy(&reportSem);
+        return;
+    }
+    mla_atomic_store(&reporterReady, true);
+#if MLA_REPORT_SIGNAL
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = MlaReportSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(MLA_REPORT_SIGNAL, &action, &reportAction);
+#endif
+}
+
+/* 先恢复信号处理并停止接受请求，再唤醒后台线程等待其退出，之后才能销毁信号量 */
+static void MlaReporterStop(void)
+{
+    if (!mla_atomic_load(&reporterReady)) {
+        return;
+    }
+#if MLA_REPORT_SIGNAL
+    sigaction(MLA_REPORT_SIGNAL, &reportAction, NULL);
+#endif
+    mla_atomic_store(&reporterReady, false);
+    mla_atomic_store(&reporterStop, true);
+    sem_post(&reportSem);
+    pthread_join(reporter, NULL);
+    sem_destroy(&reportSem);
+}
+#endif
+
+/* 请求后台线程输出一次报告，只调用sem_post，可在信号处理函数中使用；未开启CFG_MLA_REPORTER时返回-1 */
+int MlaReportRequest(void)
+{
+#if CFG_MLA_REPORTER
+    return MlaReportPost();
+#else
+    return -1;
+#endif
+}
+
+/* 返回输出的记录器个数，失败返回-1 */
+int MlaOutput(void)
+{
+#if CFG_MLA_FUNCTION && CFG_MLA_VERBOSE
+    uint8_t alignWidth = 128;
+#elif CFG_MLA_FUNCTION
     uint8_t alignWidth = 112;
 #else
     uint8_t alignWidth = 96;
 #endif
+    MlaRows_t rows;
+    uint16_t count = 0;
+#if CFG_MLA_THREAD_CACHE
+    MlaCacheFlush();
+#endif
+    mla_lock(&outputLock);
+    if (MlaRowsBuild(&rows) != 0) {
+        mla_unlock(&outputLock);
+        return -1;
+    }
     MLA_OUTPUT("*""%-*s""*", alignWidth, "");
     MLA_OUTPUT("%s", MlaTitle);
     MLA_OUTPUT("*""%-*s""*", alignWidth, "");
-    if (mla_list_node_count_get(&recorderList) == 0) {
+    MlaRowsForeach(&rows, MlaCountInfo, &count);
+    if (count == 0) {
         char *mlaNone = "M L A  N O N E";
         uint8_t mlaNoneWidth = (alignWidth - strlen(mlaNone)) / 2;
         MLA_OUTPUT("*""%-*s%s%-*s""*", mlaNoneWidth, "", mlaNone, mlaNoneWidth, "");
     } else {
         bool overview = true;
-        MLA_OUTPUT(" ""%-*s%-16s%-16s%-16s%s", BUFFER_SIZE - 10, "Caller", "Hash", "Malloc", "Free", "Diff");
-        mla_slist_foreach(&recorderList, MlaCollectInfo, &overview);
+        MLA_OUTPUT(" ""%-*s%-16s%-16s%-16s%s", BUFFER_SIZE - 10, "Caller", "Site", "Malloc", "Free", "Diff");
+        MlaRowsForeach(&rows, MlaCollectInfo, &overview);
+#if CFG_MLA_VERBOSE
+        mlaIndex = 0;
+        MLA_OUTPUT("\r\n%s\r\n", OVSplitLine);
+        MlaRowsForeach(&rows, MlaCollectInfo, NULL);
+#endif
+        MlaOutputBytes(&rows);
+    }
+#if CFG_MLA_SAMPLE
+    if (count != 0) {
+        MlaOutputSample(&rows);
+    }
+#endif
+#if CFG_MLA_LIFETIME
+    if (count != 0) {
+        MlaOutputLifetime(&rows);
+    }
+#endif
+#if CFG_MLA_STACK
+    if (count != 0) {
+        MlaOutputStack(&rows);
+    }
+#endif
+#if CFG_MLA_LIVE_TABLE
+    if (count != 0) {
+        MlaOutputLive(&rows);
+    }
+#endif
+    MlaOutputMetadata();
+#if CFG_MLA_POOL
+    MlaOutputPool();
+#endif
+    mla_unlock(&outputLock);
+    MLA_FREE(rows.item);
+    return count;
+}
+
+/* 只输出自上次增量输出以来计数有变化的记录器，开销与期间活跃的调用点数成正比，与记录器总数无关；返回输出的行数 */
+int MlaOutputChanged(void)
+{
+    uint16_t count = 0;
+#if CFG_MLA_THREAD_CACHE
+    MlaCacheFlush();
+#endif
+    mla_lock(&outputLock);
+    mla_lock(&recorderLock);
+    // 先读next再清除标记，清除后其他线程才可能将其重新压入；同时反转为首次变化的顺序
+    Mla_t *item = mla_atomic_xchg(&dirtyList, NULL);
+    Mla_t *changed = NULL;
+    while (item != NULL) {
+        Mla_t *next = item->dirtyNext;
+        item->reportNext = changed;
+        changed = item;
+        mla_atomic_store(&item->dirty, 0);
+        item = next;
+    }
+    bool overview = true;
+    void *arg = &overview;
+    void *countArg = &count;
+    MLA_OUTPUT("\r\n"" ""%-*s%-16s%-16s%-16s%s", BUFFER_SIZE - 10, "Changed", "Site", "Malloc", "Free", "Diff");
+    for (item = changed; item != NULL; item = item->reportNext) {
+        mla_list_node_t *node = &item->node;
+        MlaCountInfo(&countArg, &node);  // 只计入会输出的记录器，与MlaOutput的统计口径一致
+        MlaCollectInfo(&arg, &node);
+    }
 #if CFG_MLA_VERBOSE
+    if (count != 0) {
         mlaIndex = 0;
+        arg = NULL;
         MLA_OUTPUT("\r\n%s\r\n", OVSplitLine);
-        mla_slist_foreach(&recorderList, MlaCollectInfo, NULL);
+        for (item = changed; item != NULL; item = item->reportNext) {
+            mla_list_node_t *node = &item->node;
+            MlaCollectInfo(&arg, &node);
+        }
+    }
+#endif
+    mla_unlock(&recorderLock);
+    mla_unlock(&outputLock);
+    return count;
+}
+
+/* 汇总所有调用点的申请与释放次数 */
+void MlaStat(uint32_t *mallocCount, uint32_t *freeCount)
+{
+    uint32_t stat[2] = {0};
+#if CFG_MLA_THREAD_CACHE
+    MlaCacheFlush();
+#endif
+    mla_lock(&recorderLock);
+    mla_slist_foreach(&recorderList, MlaStatInfo, stat);
+    mla_unlock(&recorderLock);
+    if (mallocCount != NULL) {
+        *mallocCount = stat[0];
+    }
+    if (freeCount != NULL) {
+        *freeCount = stat[1];
+    }
+}
+
+/* 未编译进来的模式不可切换 */
+static int MlaModeSet(int mode)
+{
+    switch (mode) {
+        case MLA_MODE_OFF:
+        case MLA_MODE_COUNTS:
+            break;
+#if CFG_MLA_VERBOSE
+        case MLA_MODE_VERBOSE:
+            break;
+#endif
+#if CFG_MLA_SAMPLE
+        case MLA_MODE_SAMPLED:
+            break;
+#endif
+        default:
+            LOGE("%s - %s. mode %d is not supported", __FILENAME__, __func__, mode);
+            return -1;
+    }
+    mla_atomic_store(&mlaMode, mode);
+    return 0;
+}
+
+/* 运行中切换记录模式，只影响之后的申请，此前被记录的内存释放时仍计入其记录器；关闭后PORT_MALLOC只比MLA_MALLOC多一次判断和头部写入 */
+int MlaSetMode(int mode)
+{
+    return MlaModeSet(mode);
+}
+
+int MlaGetMode(void)
+{
+    return mla_atomic_load(&mlaMode);
+}
+
+/* 环境变量MLA_MODE可在初始化时选择模式：off、counts、verbose、sampled */
+static void MlaModeEnv(void)
+{
+    static const char * const name[] = {"off", "counts", "verbose", "sampled"};
+    const char *env = getenv("MLA_MODE");
+    if (env == NULL) {
+        return;
+    }
+    for (int i = 0; i < (int)(sizeof(name) / sizeof(name[0])); i++) {
+        if (strcmp(env, name[i]) == 0) {
+            MlaModeSet(i);
+            return;
+        }
+    }
+    LOGE("%s - %s. unknown MLA_MODE %s", __FILENAME__, __func__, env);
+}
+
+/* 整体释放所有记录器；仍有被记录且未释放的内存时其头部引用着记录器，拒绝释放，调用时不应有并发的申请 */
+static int MlaReset(void)
+{
+    uint64_t blocks = mla_atomic_load(&mlaLiveBlocks);
+    if (blocks != 0) {
+        LOGE("%s - %s. %llu tracked blocks are still in use", __FILENAME__, __func__, (unsigned long long)blocks);
+        return -1;
+    }
+#if CFG_MLA_THREAD_CACHE
+    // 线程缓存仍被各线程持有，只清空其中对记录器的引用
+    mla_lock(&cacheLock);
+    mla_slist_foreach(&cacheList, MlaCacheClearNode, NULL);
+    mla_unlock(&cacheLock);
+#endif
+    mla_lock(&outputLock);
+    mla_lock(&recorderLock);
+    mla_list_init(&recorderList);
+    recorderTail = &recorderList;
+    memset(recorderBucket, 0, sizeof(recorderBucket));
+    dirtyList = NULL;
+    mlaLiveBytes = 0;
+    mlaPeakBytes = 0;
+    mla_slab_release(&recorderSlab);
+#if CFG_MLA_VERBOSE
+    memset(freeBucket, 0, sizeof(freeBucket));
+    mla_slab_release(&freeInfoSlab);
+#endif
+#if CFG_MLA_LIVE_TABLE
+    memset(liveTable, 0, sizeof(liveTable));
+    liveDropped = 0;
+#endif
+#if CFG_MLA_STACK
+    memset(stackTable, 0, sizeof(stackTable));
+    stackDropped = 0;
+#endif
+    mla_unlock(&recorderLock);
+    mla_unlock(&outputLock);
+    return 0;
+}
+
+/* 先停止后台输出线程和记录再释放slab，之后的申请释放走不记录的路径；仍有未释放的内存时恢复记录并返回-1 */
+int MlaDeinit(void)
+{
+    CHECK(mlaReady, -1);
+#if CFG_MLA_REPORTER
+    MlaReporterStop();
 #endif
+    mla_atomic_store(&mlaReady, false);
+    if (MlaReset() != 0) {
+        mla_atomic_store(&mlaReady, true);
+#if CFG_MLA_REPORTER
+        MlaReporterStart();
+#endif
+        return -1;
     }
+    return 0;
 }
 
+/* 重复调用时清空所有记录器，有未释放的内存时保留原有记录 */
 void MlaInit(void)
 {
+    MlaModeEnv();
+    if (mlaReady) {
+        MlaReset();
+        return;
+    }
     mla_list_init(&recorderList);
+    recorderTail = &recorderList;
+    memset(recorderBucket, 0, sizeof(recorderBucket));
+    mla_lock_init(&recorderLock);
+    mla_lock_init(&outputLock);
+    for (uint16_t i = 0; i < MLA_LOCK_SHARDS; i++) {
+        mla_lock_init(&shardLock[i]);
+    }
+    _Static_assert(MLA_SLAB_CHUNKS(Mla_t) >= 16, "MLA_SLAB_PAGE_SIZE too small for recorders");
+    mla_slab_init(&recorderSlab, sizeof(Mla_t), MLA_SLAB_CHUNKS(Mla_t));
+#if CFG_MLA_VERBOSE
+    memset(freeBucket, 0, sizeof(freeBucket));
+    mla_slab_init(&freeInfoSlab, sizeof(MlaFreeInfo_t), MLA_SLAB_CHUNKS(MlaFreeInfo_t));
+#endif
+#if CFG_MLA_STACK
+    mla_lock_init(&stackLock);
+#endif
+#if CFG_MLA_THREAD_CACHE
+    if (!cacheReady) {
+        mla_list_init(&cacheList);
+        mla_lock_init(&cacheLock);
+        _Static_assert(MLA_SLAB_CHUNKS(MlaCache_t) >= 1, "MLA_SLAB_PAGE_SIZE too small for thread caches");
+        mla_slab_init(&cacheSlab, sizeof(MlaCache_t), MLA_SLAB_CHUNKS(MlaCache_t));
+        pthread_key_create(&cacheKey, MlaCacheExit);
+        cacheReady = true;
+    }
+#endif
+    mla_atomic_store(&mlaReady, true);
+#if CFG_MLA_REPORTER
+    MlaReporterStart();
+#endif
 }
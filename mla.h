@@ -14,15 +14,59 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define CFG_MLA_POOL    0  // 使用内置的分级内存池(pool.c)作为MLA_MALLOC后端，同时输出内存池占用与碎片信息
+
 /* MLA内部使用的内存管理接口 */
+#if CFG_MLA_POOL
+#define MLA_MALLOC(size)    pool_malloc(size)
+#define MLA_FREE(addr)      pool_free(addr)
+#define MLA_REALLOC(addr, size)    pool_realloc(addr, size)
+#else
 #define MLA_MALLOC(size)    malloc(size)
 #define MLA_FREE(addr)      free(addr)
+#define MLA_REALLOC(addr, size)    realloc(addr, size)
+#endif
+
+#ifndef MLA_SITE
+/* 调用点描述符，每个PORT_MALLOC/PORT_FREE展开处静态生成一份，热路径只传递其地址 */
+typedef struct {
+    const char *file;
+    const char *func;
+    uint16_t line;
+    uint32_t id;  // 首次使用时分配，0表示尚未分配
+} MlaSite_t;
+
+#define MLA_SITE()    ({ static MlaSite_t mlaSite = {__FILE__, __func__, __LINE__, 0}; &mlaSite; })
+#endif
+
+/* 运行时记录模式，见MlaSetMode */
+#define MLA_MODE_OFF        (0)  // 只写入头部，不做记录
+#define MLA_MODE_COUNTS     (1)  // 记录申请调用点的次数与字节数
+#define MLA_MODE_VERBOSE    (2)  // 另记录释放调用点，需开启CFG_MLA_VERBOSE
+#define MLA_MODE_SAMPLED    (3)  // 按字节采样记录，需开启CFG_MLA_SAMPLE
 
 /* 对外提供使用的内存泄漏检查的分配释放接口 */
-#define PORT_MALLOC(size)    MlaMalloc(size, __FILENAME__, __func__, __LINE__)
-#define PORT_FREE(addr)      MlaFree(addr, __FILENAME__, __func__, __LINE__)
+#define PORT_MALLOC(size)    MlaMalloc(size, MLA_SITE())
+#define PORT_FREE(addr)      MlaFree(addr, MLA_SITE())
+#define PORT_CALLOC(num, size)    MlaCalloc(num, size, MLA_SITE())
+#define PORT_REALLOC(addr, size)    MlaRealloc(addr, size, MLA_SITE())
+#define PORT_ALIGNED_ALLOC(alignment, size)    MlaAlignedAlloc(alignment, size, MLA_SITE())
+#define PORT_POSIX_MEMALIGN(memptr, alignment, size)    MlaPosixMemalign(memptr, alignment, size, MLA_SITE())
 
 void MlaInit(void);
+int MlaDeinit(void);
 int MlaOutput(void);
-void *MlaMalloc(uint32_t size, char *file, char *func, uint16_t line);
-void MlaFree(void *addr, char *file, char *func, uint16_t line);
+int MlaOutputChanged(void);
+int MlaSnapshot(const char *path);
+int MlaReportRequest(void);
+int MlaSetMode(int mode);
+int MlaGetMode(void);
+void *MlaMalloc(uint32_t size, MlaSite_t *site);
+void MlaFree(void *addr, MlaSite_t *site);
+void *MlaCalloc(uint32_t num, uint32_t size, MlaSite_t *site);
+void *MlaRealloc(void *addr, uint32_t size, MlaSite_t *site);
+void *MlaAlignedAlloc(uint32_t alignment, uint32_t size, MlaSite_t *site);
+int MlaPosixMemalign(void **memptr, uint32_t alignment, uint32_t size, MlaSite_t *site);
+bool MlaOwned(void *addr);
+uint32_t MlaUsableSize(void *addr);
+void MlaStat(uint32_t *mallocCount, uint32_t *freeCount);
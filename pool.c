@@ -0,0 +1,203 @@
+/**
+ * @file pool.c
+ * @author skull (skull.gu@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2023 skull
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "pool.h"
+#include "adapter.h"
+
+#define TAG    "POOL"
+
+#if CFG_MLA_POOL
+#define POOL_ARENA_SIZE    (4 * 1024 * 1024)
+#define POOL_LARGE         (POOL_CLASS_NUM)  // head index of a block above POOL_SIZE_MAX, taken from the system allocator
+
+typedef struct {
+    uint32_t index;
+    uint32_t size;
+} pool_head_t;
+
+typedef struct {
+    void *p_free;
+    pool_stat_t stat;
+    pthread_mutex_t lock;
+} pool_class_t;
+
+static uint8_t arena[POOL_ARENA_SIZE] __attribute__((aligned(16)));
+static uint32_t arena_offset;
+static pool_class_t pool_class[POOL_CLASS_NUM + 1] = {
+    [0 ... POOL_CLASS_NUM] = {.lock = PTHREAD_MUTEX_INITIALIZER}
+};
+
+static int8_t pool_class_index(uint32_t size)
+{
+    uint32_t block = POOL_CLASS_MIN;
+    for (uint8_t i = 0; i < POOL_CLASS_NUM; i++, block <<= 1) {
+        if (size + POOL_HEAD_SIZE <= block) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* large blocks are counted in the extra class, total follows used since they go back to the system at once */
+static void *pool_large_malloc(uint32_t size)
+{
+    uint8_t *p_block = malloc(size + POOL_HEAD_SIZE);
+    if (p_block == NULL) {
+        LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+        return NULL;
+    }
+
+    pool_class_t *p_class = &pool_class[POOL_LARGE];
+    mla_lock(&p_class->lock);
+    p_class->stat.total++;
+    p_class->stat.used++;
+    p_class->stat.requested += size;
+    if (p_class->stat.used > p_class->stat.peak) {
+        p_class->stat.peak = p_class->stat.used;
+    }
+    mla_unlock(&p_class->lock);
+
+    ((pool_head_t *)p_block)->index = POOL_LARGE;
+    ((pool_head_t *)p_block)->size = size;
+    return p_block + POOL_HEAD_SIZE;
+}
+
+static void pool_large_free(pool_head_t *p_head)
+{
+    pool_class_t *p_class = &pool_class[POOL_LARGE];
+    mla_lock(&p_class->lock);
+    p_class->stat.total--;
+    p_class->stat.used--;
+    p_class->stat.requested -= p_head->size;
+    mla_unlock(&p_class->lock);
+    free(p_head);
+}
+
+void *pool_malloc(uint32_t size)
+{
+    int8_t index = pool_class_index(size);
+    if (index < 0) {
+        return pool_large_malloc(size);
+    }
+
+    pool_class_t *p_class = &pool_class[index];
+    uint32_t block = POOL_CLASS_MIN << index;
+    uint8_t *p_block = NULL;
+    mla_lock(&p_class->lock);
+    if (p_class->p_free != NULL) {
+        p_block = p_class->p_free;
+        p_class->p_free = *(void **)(p_block + POOL_HEAD_SIZE);
+    } else {
+        uint32_t offset = mla_atomic_add(&arena_offset, block);
+        if (offset + block > POOL_ARENA_SIZE) {
+            mla_atomic_add(&arena_offset, -block);
+            mla_unlock(&p_class->lock);
+            LOGE("%s - %s : %u. arena exhausted!", __FILENAME__, __func__, __LINE__);
+            return NULL;
+        }
+        p_block = &arena[offset];
+        p_class->stat.total++;
+    }
+    p_class->stat.used++;
+    p_class->stat.requested += size;
+    if (p_class->stat.used > p_class->stat.peak) {
+        p_class->stat.peak = p_class->stat.used;
+    }
+    mla_unlock(&p_class->lock);
+
+    ((pool_head_t *)p_block)->index = index;
+    ((pool_head_t *)p_block)->size = size;
+    return p_block + POOL_HEAD_SIZE;
+}
+
+void pool_free(void *addr)
+{
+    CHECK(addr != NULL);
+
+    uint8_t *p_block = (uint8_t *)addr - POOL_HEAD_SIZE;
+    pool_head_t *p_head = (pool_head_t *)p_block;
+    CHECK(p_head->index <= POOL_LARGE);
+    if (p_head->index == POOL_LARGE) {
+        pool_large_free(p_head);
+        return;
+    }
+
+    pool_class_t *p_class = &pool_class[p_head->index];
+    mla_lock(&p_class->lock);
+    *(void **)addr = p_class->p_free;
+    p_class->p_free = p_block;
+    p_class->stat.used--;
+    p_class->stat.requested -= p_head->size;
+    mla_unlock(&p_class->lock);
+}
+
+/* stays in place while the new size fits the current class, otherwise moves to a new block; large blocks are resized by the system */
+void *pool_realloc(void *addr, uint32_t size)
+{
+    if (addr == NULL) {
+        return pool_malloc(size);
+    }
+
+    pool_head_t *p_head = (pool_head_t *)((uint8_t *)addr - POOL_HEAD_SIZE);
+    CHECK(p_head->index <= POOL_LARGE, NULL);
+    if (p_head->index == POOL_LARGE && size > POOL_SIZE_MAX) {
+        uint32_t old_size = p_head->size;
+        p_head = realloc(p_head, size + POOL_HEAD_SIZE);
+        if (p_head == NULL) {
+            return NULL;
+        }
+        pool_class_t *p_class = &pool_class[POOL_LARGE];
+        mla_lock(&p_class->lock);
+        p_class->stat.requested += size - old_size;
+        mla_unlock(&p_class->lock);
+        p_head->size = size;
+        return (uint8_t *)p_head + POOL_HEAD_SIZE;
+    }
+    if (p_head->index < POOL_LARGE && size + POOL_HEAD_SIZE <= (uint32_t)(POOL_CLASS_MIN << p_head->index)) {
+        pool_class_t *p_class = &pool_class[p_head->index];
+        mla_lock(&p_class->lock);
+        p_class->stat.requested += size - p_head->size;
+        mla_unlock(&p_class->lock);
+        p_head->size = size;
+        return addr;
+    }
+
+    void *p_new = pool_malloc(size);
+    if (p_new == NULL) {
+        return NULL;
+    }
+    memcpy(p_new, addr, p_head->size < size ? p_head->size : size);
+    pool_free(addr);
+    return p_new;
+}
+
+int pool_stat_get(uint8_t index, pool_stat_t *p_stat)
+{
+    CHECK(p_stat != NULL, -0xFF);
+    if (index > POOL_LARGE) {
+        return -1;
+    }
+
+    mla_lock(&pool_class[index].lock);
+    *p_stat = pool_class[index].stat;
+    mla_unlock(&pool_class[index].lock);
+    p_stat->block_size = index == POOL_LARGE ? 0 : POOL_CLASS_MIN << index;
+    return 0;
+}
+
+uint32_t pool_arena_free_get(void)
+{
+    uint32_t offset = mla_atomic_load(&arena_offset);
+    return offset > POOL_ARENA_SIZE ? 0 : POOL_ARENA_SIZE - offset;
+}
+#endif
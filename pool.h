@@ -0,0 +1,33 @@
+/**
+ * @file pool.h
+ * @author skull (skull.gu@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2023 skull
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define POOL_CLASS_MIN     (16)  // the smallest block, each class doubles the previous one
+#define POOL_CLASS_NUM     (10)  // 16B ~ 8KB
+#define POOL_HEAD_SIZE     (16)  // keeps the returned address 16-byte aligned
+#define POOL_SIZE_MAX      ((POOL_CLASS_MIN << (POOL_CLASS_NUM - 1)) - POOL_HEAD_SIZE)  // the largest request a class can hold
+
+typedef struct {
+    uint32_t block_size;  // 0 for the blocks above POOL_SIZE_MAX, which come from the system allocator
+    uint32_t total;  // blocks carved from the arena
+    uint32_t used;
+    uint32_t peak;
+    uint32_t requested;  // bytes requested by the blocks in use
+} pool_stat_t;
+
+void *pool_malloc(uint32_t size);
+void pool_free(void *addr);
+void *pool_realloc(void *addr, uint32_t size);
+
+int pool_stat_get(uint8_t index, pool_stat_t *p_stat);
+uint32_t pool_arena_free_get(void);
@@ -0,0 +1,341 @@
+/**
+ * @file mla_preload.c
+ * @author skull (skull.gu@gmail.com)
+ * @brief LD_PRELOAD interposer, tracks every heap allocation of an unmodified program
+ * @version 0.1
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2023 skull
+ *
+ * $ ./do.sh preload
+ * $ LD_PRELOAD=./libmla.so <program>
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include "adapter.h"
+
+#define TAG    "PRELOAD"
+#define PRELOAD_EXPORT    __attribute__((visibility("default")))
+#define PRELOAD_BOOTSTRAP_SIZE    (64 * 1024)  // serves the allocations made by dlsym before the real allocator is known
+#define PRELOAD_SITE_SIZE         (4096)  // distinct call sites, must be a power of 2
+#define PRELOAD_SITE_PROBE        (64)
+#define PRELOAD_SITE_BUSY         ((void *)1)
+#define PRELOAD_SIZE_MAX          (UINT32_MAX - 4096)  // MLA records sizes as uint32_t, larger blocks are not tracked
+#define PRELOAD_ALIGN_MAX         (1 << 20)  // the largest alignment MLA can record in its header
+
+enum {PRELOAD_NONE, PRELOAD_RESOLVING, PRELOAD_RESOLVED, PRELOAD_READY};
+
+typedef struct {
+    void *caller;
+    MlaSite_t site;
+    char name[48];
+} preload_site_t;
+
+static struct {
+    void *(*malloc)(size_t);
+    void (*free)(void *);
+    void *(*calloc)(size_t, size_t);
+    void *(*realloc)(void *, size_t);
+    void *(*memalign)(size_t, size_t);
+    size_t (*malloc_usable_size)(void *);
+} real;
+
+static uint8_t state;
+static __thread uint8_t guard __attribute__((tls_model("initial-exec")));  // set while MLA itself runs, nested allocations go straight to the real allocator
+static uint8_t bootstrap[PRELOAD_BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static uint32_t bootstrap_used;
+static preload_site_t site_table[PRELOAD_SITE_SIZE];
+static MlaSite_t site_unknown = {"unknown", "??", 0, 0};
+
+static void preload_resolve(void)
+{
+    uint8_t expect = PRELOAD_NONE;
+    if (!mla_atomic_cas(&state, &expect, PRELOAD_RESOLVING)) {
+        return;
+    }
+    real.malloc = dlsym(RTLD_NEXT, "malloc");
+    real.free = dlsym(RTLD_NEXT, "free");
+    real.calloc = dlsym(RTLD_NEXT, "calloc");
+    real.realloc = dlsym(RTLD_NEXT, "realloc");
+    real.memalign = dlsym(RTLD_NEXT, "memalign");
+    real.malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+    mla_atomic_store(&state, PRELOAD_RESOLVED);
+}
+
+/* bump allocation that is never given back, the size is kept in front of the block for realloc */
+static void *preload_bootstrap(size_t alignment, size_t size)
+{
+    alignment = alignment < 16 ? 16 : alignment;
+    if (size > PRELOAD_BOOTSTRAP_SIZE || alignment > PRELOAD_BOOTSTRAP_SIZE) {
+        return NULL;
+    }
+    uint32_t need = size + 16 + alignment;
+    uint32_t offset = mla_atomic_add(&bootstrap_used, need);
+    if (offset + need > PRELOAD_BOOTSTRAP_SIZE) {
+        return NULL;
+    }
+    uintptr_t addr = ((uintptr_t)&bootstrap[offset] + 16 + alignment - 1) & ~((uintptr_t)alignment - 1);
+    ((size_t *)addr)[-1] = size;
+    return (void *)addr;
+}
+
+static bool preload_is_bootstrap(void *addr)
+{
+    return (uint8_t *)addr >= bootstrap && (uint8_t *)addr < bootstrap + PRELOAD_BOOTSTRAP_SIZE;
+}
+
+static void *preload_raw(size_t alignment, size_t size)
+{
+    if (mla_atomic_load(&state) == PRELOAD_NONE) {
+        preload_resolve();
+    }
+    if (mla_atomic_load(&state) < PRELOAD_RESOLVED) {
+        return preload_bootstrap(alignment, size);
+    }
+    return alignment == 0 ? real.malloc(size) : real.memalign(alignment, size);
+}
+
+/* allocations are tracked only once MLA is initialized and never from inside MLA itself */
+static bool preload_tracked(void)
+{
+    return !guard && mla_atomic_load(&state) == PRELOAD_READY;
+}
+
+static void preload_site_name(preload_site_t *entry, void *caller)
+{
+    Dl_info info;
+    entry->site.file = "??";
+    entry->site.func = entry->name;
+    if (dladdr(caller, &info) == 0) {
+        snprintf(entry->name, sizeof(entry->name), "%p", caller);
+        return;
+    }
+    if (info.dli_fname != NULL && info.dli_fname[0] != '\0') {
+        const char *slash = strrchr(info.dli_fname, '/');
+        entry->site.file = slash != NULL ? slash + 1 : info.dli_fname;
+    }
+    // there is no line number, the module offset goes first so a long symbol cannot truncate it
+    unsigned long offset = (unsigned long)((uintptr_t)caller - (uintptr_t)info.dli_fbase);
+    if (info.dli_sname != NULL) {
+        snprintf(entry->name, sizeof(entry->name), "+0x%lx %s+0x%lx", offset, info.dli_sname,
+            (unsigned long)((uintptr_t)caller - (uintptr_t)info.dli_saddr));
+    } else {
+        snprintf(entry->name, sizeof(entry->name), "+0x%lx", offset);
+    }
+}
+
+/* the return address identifies the call site, each one gets a static MlaSite_t the first time it is seen */
+static MlaSite_t *preload_site(void *caller)
+{
+    uint32_t slot = (uint32_t)(((uintptr_t)caller * 0x9E3779B97F4A7C15ull) >> 32);
+    for (uint16_t i = 0; i < PRELOAD_SITE_PROBE; i++) {
+        preload_site_t *entry = &site_table[(slot + i) & (PRELOAD_SITE_SIZE - 1)];
+        void *key = mla_atomic_load(&entry->caller);
+        while (key == NULL || key == PRELOAD_SITE_BUSY) {
+            if (key == NULL && mla_atomic_cas(&entry->caller, &key, PRELOAD_SITE_BUSY)) {
+                preload_site_name(entry, caller);
+                mla_atomic_store(&entry->caller, caller);
+                return &entry->site;
+            }
+            if (key == PRELOAD_SITE_BUSY) {
+                sched_yield();
+                key = mla_atomic_load(&entry->caller);
+            }
+        }
+        if (key == caller) {
+            return &entry->site;
+        }
+    }
+    return &site_unknown;
+}
+
+PRELOAD_EXPORT void *malloc(size_t size)
+{
+    if (!preload_tracked() || size > PRELOAD_SIZE_MAX) {
+        return preload_raw(0, size);
+    }
+    guard = 1;
+    void *addr = MlaMalloc(size, preload_site(__builtin_return_address(0)));
+    guard = 0;
+    return addr;
+}
+
+static void preload_free(void *addr, void *caller)
+{
+    if (addr == NULL || preload_is_bootstrap(addr) || mla_atomic_load(&state) < PRELOAD_RESOLVED) {
+        return;
+    }
+    if (!MlaOwned(addr)) {
+        real.free(addr);
+        return;
+    }
+    uint8_t nested = guard;
+    guard = 1;
+    MlaFree(addr, preload_site(caller));
+    guard = nested;
+}
+
+PRELOAD_EXPORT void free(void *addr)
+{
+    preload_free(addr, __builtin_return_address(0));
+}
+
+/* C23 sized deallocation, the size is only a hint so these are plain frees; harmless where libc does not have them */
+PRELOAD_EXPORT void free_sized(void *addr, size_t size)
+{
+    UNUSED(size);
+    preload_free(addr, __builtin_return_address(0));
+}
+
+PRELOAD_EXPORT void free_aligned_sized(void *addr, size_t alignment, size_t size)
+{
+    UNUSED(alignment);
+    UNUSED(size);
+    preload_free(addr, __builtin_return_address(0));
+}
+
+/* glibc would read the MLA header as its chunk header, so MLA blocks report the size they were requested with */
+PRELOAD_EXPORT size_t malloc_usable_size(void *addr)
+{
+    if (addr == NULL) {
+        return 0;
+    }
+    if (preload_is_bootstrap(addr)) {
+        return ((size_t *)addr)[-1];
+    }
+    if (MlaOwned(addr)) {
+        return MlaUsableSize(addr);
+    }
+    return real.malloc_usable_size != NULL ? real.malloc_usable_size(addr) : 0;
+}
+
+PRELOAD_EXPORT void *calloc(size_t num, size_t size)
+{
+    if (size != 0 && num > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!preload_tracked() || num * size > PRELOAD_SIZE_MAX) {
+        if (mla_atomic_load(&state) < PRELOAD_RESOLVED) {
+            return preload_raw(0, num * size);  // the bootstrap buffer is static, already zeroed
+        }
+        return real.calloc(num, size);
+    }
+    guard = 1;
+    void *addr = MlaCalloc(1, num * size, preload_site(__builtin_return_address(0)));
+    guard = 0;
+    return addr;
+}
+
+PRELOAD_EXPORT void *realloc(void *addr, size_t size)
+{
+    void *caller = __builtin_return_address(0);
+    if (addr == NULL) {
+        if (!preload_tracked() || size > PRELOAD_SIZE_MAX) {
+            return preload_raw(0, size);
+        }
+        guard = 1;
+        addr = MlaMalloc(size, preload_site(caller));
+        guard = 0;
+        return addr;
+    }
+    if (preload_is_bootstrap(addr)) {
+        size_t old = ((size_t *)addr)[-1];
+        void *ptr = malloc(size);
+        if (ptr != NULL) {
+            memcpy(ptr, addr, old < size ? old : size);
+        }
+        return ptr;
+    }
+    if (!MlaOwned(addr)) {
+        return real.realloc(addr, size);
+    }
+    if (size > PRELOAD_SIZE_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    uint8_t nested = guard;
+    guard = 1;
+    void *ptr = MlaRealloc(addr, size, preload_site(caller));
+    guard = nested;
+    return ptr;
+}
+
+PRELOAD_EXPORT void *reallocarray(void *addr, size_t num, size_t size)
+{
+    if (size != 0 && num > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(addr, num * size);
+}
+
+static void *preload_align(size_t alignment, size_t size, void *caller)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!preload_tracked() || size > PRELOAD_SIZE_MAX || alignment > PRELOAD_ALIGN_MAX) {
+        return preload_raw(alignment, size);
+    }
+    guard = 1;
+    void *addr = MlaAlignedAlloc(alignment, size, preload_site(caller));
+    guard = 0;
+    return addr;
+}
+
+PRELOAD_EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *addr = preload_align(alignment, size, __builtin_return_address(0));
+    if (addr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = addr;
+    return 0;
+}
+
+PRELOAD_EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    return preload_align(alignment, size, __builtin_return_address(0));
+}
+
+PRELOAD_EXPORT void *memalign(size_t alignment, size_t size)
+{
+    return preload_align(alignment, size, __builtin_return_address(0));
+}
+
+PRELOAD_EXPORT void *valloc(size_t size)
+{
+    return preload_align(sysconf(_SC_PAGESIZE), size, __builtin_return_address(0));
+}
+
+PRELOAD_EXPORT void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return preload_align(page, (size + page - 1) & ~(page - 1), __builtin_return_address(0));
+}
+
+__attribute__((constructor)) static void preload_init(void)
+{
+    guard = 1;
+    preload_resolve();
+    log_init();
+    MlaInit();
+    mla_atomic_store(&state, PRELOAD_READY);
+    guard = 0;
+}
+
+/* the log stays open, other threads may still be running while the process exits */
+__attribute__((destructor)) static void preload_exit(void)
+{
+    guard = 1;
+    mla_atomic_store(&state, PRELOAD_RESOLVED);
+    MlaOutput();
+}
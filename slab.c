@@ -0,0 +1,121 @@
+/**
+ * @file slab.c
+ * @author skull (skull.gu@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2023 skull
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include "slab.h"
+#include "adapter.h"
+
+#define TAG    "SLAB"
+
+int slab_init(slab_t *p_slab, uint32_t chunk_size, uint32_t chunk_num)
+{
+    CHECK(p_slab != NULL, -0xFF);
+    CHECK(chunk_num != 0, -0xFF);
+
+    // every chunk must be able to hold the free list pointer and keep pointer alignment
+    chunk_size = (chunk_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    p_slab->chunk_size = chunk_size < sizeof(void *) ? sizeof(void *) : chunk_size;
+    p_slab->chunk_num = chunk_num;
+    p_slab->p_page = NULL;
+    p_slab->p_free = NULL;
+    p_slab->p_bump = NULL;
+    p_slab->bump_num = 0;
+    p_slab->page_count = 0;
+    p_slab->used_count = 0;
+    mla_lock_init(&p_slab->lock);
+    return 0;
+}
+
+int slab_release(slab_t *p_slab)
+{
+    CHECK(p_slab != NULL, -0xFF);
+
+    mla_lock(&p_slab->lock);
+    slab_page_t *p_page = p_slab->p_page;
+    while (p_page != NULL) {
+        slab_page_t *p_next = p_page->p_next;
+        MLA_FREE(p_page);
+        p_page = p_next;
+    }
+    p_slab->p_page = NULL;
+    p_slab->p_free = NULL;
+    p_slab->p_bump = NULL;
+    p_slab->bump_num = 0;
+    p_slab->page_count = 0;
+    p_slab->used_count = 0;
+    mla_unlock(&p_slab->lock);
+    return 0;
+}
+
+void *slab_alloc(slab_t *p_slab)
+{
+    CHECK(p_slab != NULL, NULL);
+
+    void *p_chunk = NULL;
+    mla_lock(&p_slab->lock);
+    if (p_slab->p_free != NULL) {
+        p_chunk = p_slab->p_free;
+        p_slab->p_free = *(void **)p_chunk;
+    } else {
+        if (p_slab->bump_num == 0) {
+            slab_page_t *p_page = (slab_page_t *)MLA_MALLOC(sizeof(slab_page_t) + p_slab->chunk_size * p_slab->chunk_num);
+            if (p_page == NULL) {
+                mla_unlock(&p_slab->lock);
+                LOGE("%s - %s : %u. malloc fail!", __FILENAME__, __func__, __LINE__);
+                return NULL;
+            }
+            p_page->p_next = p_slab->p_page;
+            p_slab->p_page = p_page;
+            p_slab->p_bump = (uint8_t *)(p_page + 1);
+            p_slab->bump_num = p_slab->chunk_num;
+            p_slab->page_count++;
+        }
+        p_chunk = p_slab->p_bump;
+        p_slab->p_bump += p_slab->chunk_size;
+        p_slab->bump_num--;
+    }
+    p_slab->used_count++;
+    mla_unlock(&p_slab->lock);
+    return p_chunk;
+}
+
+int slab_free(slab_t *p_slab, void *p_chunk)
+{
+    CHECK(p_slab != NULL, -0xFF);
+    CHECK(p_chunk != NULL, -0xFF);
+
+    mla_lock(&p_slab->lock);
+    *(void **)p_chunk = p_slab->p_free;
+    p_slab->p_free = p_chunk;
+    p_slab->used_count--;
+    mla_unlock(&p_slab->lock);
+    return 0;
+}
+
+uint32_t slab_reserved_get(slab_t *p_slab)
+{
+    CHECK(p_slab != NULL, 0);
+
+    mla_lock(&p_slab->lock);
+    uint32_t page_count = p_slab->page_count;
+    mla_unlock(&p_slab->lock);
+    return page_count * (sizeof(slab_page_t) + p_slab->chunk_size * p_slab->chunk_num);
+}
+
+uint32_t slab_used_get(slab_t *p_slab)
+{
+    CHECK(p_slab != NULL, 0);
+
+    mla_lock(&p_slab->lock);
+    uint32_t used_count = p_slab->used_count;
+    mla_unlock(&p_slab->lock);
+    return used_count * p_slab->chunk_size;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file slab.h
+ * @author skull (skull.gu@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2023 skull
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct _slab_page {
+    struct _slab_page *p_next;
+} slab_page_t;
+
+typedef struct {
+    uint32_t chunk_size;
+    uint32_t chunk_num;  // number of chunks per page
+    slab_page_t *p_page;  // all pages, released together by slab_release
+    void *p_free;  // free chunk list, the first word of a free chunk is the next pointer
+    uint8_t *p_bump;  // unused tail of the newest page
+    uint32_t bump_num;
+    uint32_t page_count;
+    uint32_t used_count;
+    pthread_mutex_t lock;
+} slab_t;
+
+int slab_init(slab_t *p_slab, uint32_t chunk_size, uint32_t chunk_num);
+int slab_release(slab_t *p_slab);
+void *slab_alloc(slab_t *p_slab);
+int slab_free(slab_t *p_slab, void *p_chunk);
+
+uint32_t slab_reserved_get(slab_t *p_slab);
+uint32_t slab_used_get(slab_t *p_slab);
@@ -0,0 +1,43 @@
+/**
+ * @file snapshot.h
+ * @author skull (skull.gu@gmail.com)
+ * @brief binary snapshot format written by MlaSnapshot, readable in place after mmap
+ * @version 0.1
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2023 skull
+ *
+ * layout: head | site[site_count] | string table
+ * strings are NUL-terminated and referenced by their offset in the string table
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC      (0x50414E53)  // "SNAP"
+#define SNAPSHOT_VERSION    (3)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t head_size;
+    uint32_t site_size;  // sizeof(snapshot_site_t), the reader steps by this
+    uint32_t site_count;
+    uint32_t string_offset;  // from the start of the file
+    uint32_t string_size;
+    uint64_t time_ms;  // wall clock when the snapshot was taken
+    uint64_t live_bytes;  // process-wide bytes not yet freed
+    uint64_t peak_bytes;  // high-water mark of live_bytes
+} snapshot_head_t;
+
+typedef struct {
+    uint32_t file;  // string table offsets
+    uint32_t func;
+    uint32_t line;
+    uint32_t stack;  // string table offset of the call stack, frames as "module+0xoffset" separated by spaces, empty without CFG_MLA_STACK
+    uint32_t malloc_count;
+    uint32_t free_count;
+    uint64_t live_bytes;  // bytes not yet freed, estimated in sampling mode
+    uint64_t peak_bytes;  // high-water mark of live_bytes
+    uint64_t total_bytes;  // bytes ever requested
+} snapshot_site_t;
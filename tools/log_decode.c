@@ -0,0 +1,385 @@
+/**
+ * @file log_decode.c
+ * @author skull (skull.gu@gmail.com)
+ * @brief renders a log written with CFG_LOG_BINARY as the text the LOG macros would have printed,
+ *        and prints the segments written with CFG_LOG_BACKEND_SEGMENT oldest first
+ * @version 0.1
+ * @date 2024-01-27
+ *
+ * @copyright Copyright (c) 2024 skull
+ *
+ * $ ./do.sh logdecode
+ * $ ./log_decode Log.log > Log.txt
+ * $ ./log_decode Log.*.seg > Log.txt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "logbin.h"
+#include "logseg.h"
+
+typedef struct {
+    char *level;
+    char *tag;
+    char *file;
+    char *format;
+    uint32_t line;
+} dict_t;
+
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+} payload_t;
+
+typedef struct {
+    const char *path;
+    uint8_t *data;
+    size_t size;
+    const logseg_head_t *segment;  // NULL for a binary log written to a plain file
+    int order;
+} input_t;
+
+static dict_t *dict;
+static uint32_t dict_size;
+static uint32_t site_count;
+static uint64_t event_count;
+
+static bool take(payload_t *p_data, void *value, size_t len)
+{
+    if ((size_t)(p_data->end - p_data->pos) < len) {
+        p_data->pos = p_data->end;
+        return false;
+    }
+    memcpy(value, p_data->pos, len);
+    p_data->pos += len;
+    return true;
+}
+
+static char *take_string(payload_t *p_data)
+{
+    const uint8_t *nul = memchr(p_data->pos, '\0', p_data->end - p_data->pos);
+    if (nul == NULL) {
+        p_data->pos = p_data->end;
+        return strdup("?");
+    }
+    char *str = strdup((const char *)p_data->pos);
+    p_data->pos = nul + 1;
+    return str;
+}
+
+static int dict_add(payload_t *p_data)
+{
+    uint32_t id, line;
+    if (!take(p_data, &id, sizeof(id)) || !take(p_data, &line, sizeof(line)) || id == 0) {
+        return -1;
+    }
+    if (id >= dict_size) {
+        uint32_t size = dict_size == 0 ? 64 : dict_size;
+        while (size <= id) {
+            size *= 2;
+        }
+        dict_t *grow = realloc(dict, size * sizeof(dict_t));
+        if (grow == NULL) {
+            return -1;
+        }
+        memset(grow + dict_size, 0, (size - dict_size) * sizeof(dict_t));
+        dict = grow;
+        dict_size = size;
+    }
+    dict_t *p_dict = &dict[id];
+    site_count += p_dict->format == NULL;
+    free(p_dict->level);
+    free(p_dict->tag);
+    free(p_dict->file);
+    free(p_dict->format);
+    p_dict->line = line;
+    p_dict->level = take_string(p_data);
+    p_dict->tag = take_string(p_data);
+    p_dict->file = take_string(p_data);
+    p_dict->format = take_string(p_data);
+    return 0;
+}
+
+/* one conversion, the length modifier is replaced by the width the writer stored the value with */
+static void render_one(const char *spec, char conv, int star_num, const int *star, payload_t *p_data)
+{
+    char format[64];
+    int64_t integer = 0;
+    double real = 0;
+    uint16_t len = 0;
+    static char str[UINT16_MAX + 1];
+
+    switch (conv) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            if (!take(p_data, &integer, sizeof(integer))) {
+                return;
+            }
+            snprintf(format, sizeof(format), "%sll%c", spec, conv);
+            switch (star_num) {
+                case 0: printf(format, (long long)integer); break;
+                case 1: printf(format, star[0], (long long)integer); break;
+                default: printf(format, star[0], star[1], (long long)integer); break;
+            }
+            return;
+        case 'c':
+        case 'p':
+            if (!take(p_data, &integer, sizeof(integer))) {
+                return;
+            }
+            snprintf(format, sizeof(format), "%s%c", spec, conv);
+            if (conv == 'c') {
+                switch (star_num) {
+                    case 0: printf(format, (int)integer); break;
+                    case 1: printf(format, star[0], (int)integer); break;
+                    default: printf(format, star[0], star[1], (int)integer); break;
+                }
+            } else {
+                switch (star_num) {
+                    case 0: printf(format, (void *)(uintptr_t)integer); break;
+                    case 1: printf(format, star[0], (void *)(uintptr_t)integer); break;
+                    default: printf(format, star[0], star[1], (void *)(uintptr_t)integer); break;
+                }
+            }
+            return;
+        case 's':
+            if (!take(p_data, &len, sizeof(len)) || !take(p_data, str, len)) {
+                return;
+            }
+            str[len] = '\0';
+            snprintf(format, sizeof(format), "%ss", spec);
+            switch (star_num) {
+                case 0: printf(format, str); break;
+                case 1: printf(format, star[0], str); break;
+                default: printf(format, star[0], star[1], str); break;
+            }
+            return;
+        default:
+            if (!take(p_data, &real, sizeof(real))) {
+                return;
+            }
+            snprintf(format, sizeof(format), "%s%c", spec, conv);
+            switch (star_num) {
+                case 0: printf(format, real); break;
+                case 1: printf(format, star[0], real); break;
+                default: printf(format, star[0], star[1], real); break;
+            }
+            return;
+    }
+}
+
+/* the same walk as binary_args in log.c, arguments missing from a cut record are left out */
+static void render(const char *format, payload_t *p_data)
+{
+    for (const char *p = format; *p != '\0'; p++) {
+        if (*p != '%') {
+            putchar(*p);
+            continue;
+        }
+        if (*++p == '%') {
+            putchar('%');
+            continue;
+        }
+        char spec[48] = "%";
+        uint8_t used = 1;
+        int star[2];
+        int star_num = 0;
+        int64_t value;
+        while (*p != '\0' && strchr("-+ #0'", *p) && used < 16) {
+            spec[used++] = *p++;
+        }
+        if (*p == '*') {
+            star[star_num++] = take(p_data, &value, sizeof(value)) ? (int)value : 0;
+            spec[used++] = *p++;
+        }
+        while (*p >= '0' && *p <= '9' && used < 32) {
+            spec[used++] = *p++;
+        }
+        if (*p == '.') {
+            spec[used++] = *p++;
+            if (*p == '*') {
+                star[star_num++] = take(p_data, &value, sizeof(value)) ? (int)value : 0;
+                spec[used++] = *p++;
+            }
+            while (*p >= '0' && *p <= '9' && used < 44) {
+                spec[used++] = *p++;
+            }
+        }
+        spec[used] = '\0';
+        while (*p != '\0' && strchr("hljztL", *p)) {
+            p++;
+        }
+        if (*p == '\0' || !strchr("diuoxXcpsfFeEgGaAn", *p)) {
+            return;
+        }
+        if (*p != 'n') {
+            render_one(spec, *p, star_num, star, p_data);
+        }
+    }
+}
+
+static void render_event(payload_t *p_data)
+{
+    uint32_t id;
+    uint64_t time_us;
+    if (!take(p_data, &id, sizeof(id)) || !take(p_data, &time_us, sizeof(time_us))) {
+        return;
+    }
+    if (id >= dict_size || dict[id].format == NULL) {
+        printf("?>{?} <dictionary %u missing>\r\n", id);
+        return;
+    }
+    const dict_t *p_dict = &dict[id];
+    bool view = strcmp(p_dict->level, "V") == 0;
+    if (!view) {
+        char stamp[20];
+        time_t sec = time_us / 1000000;
+        struct tm date;
+        localtime_r(&sec, &date);
+        strftime(stamp, sizeof(stamp), "%m/%d %H:%M:%S", &date);
+        const char *file = strrchr(p_dict->file, '\\') ? strrchr(p_dict->file, '\\') + 1 : p_dict->file;
+        printf("%s>%s.%03u {%.8s} <%s: %u> ", p_dict->level, stamp, (unsigned)(time_us / 1000 % 1000),
+            p_dict->tag, file, p_dict->line);
+    }
+    render(p_dict->format, p_data);
+    if (!view) {
+        printf("\r\n");
+    }
+}
+
+static int input_load(const char *path, input_t *p_input)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (data == NULL || size < 0 || fread(data, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        free(data);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    p_input->path = path;
+    p_input->data = data;
+    p_input->size = size;
+    p_input->segment = NULL;
+
+    logseg_head_t seg;
+    logbin_record_t record;
+    logbin_head_t head;
+    if ((size_t)size >= sizeof(seg) && (memcpy(&seg, data, sizeof(seg)), seg.magic == LOGSEG_MAGIC)) {
+        if (seg.version != LOGSEG_VERSION || seg.head_size < sizeof(seg) || (uint64_t)seg.head_size + seg.used > (uint64_t)size) {
+            fprintf(stderr, "%s: not a log segment of this version\n", path);
+            free(data);
+            return -1;
+        }
+        p_input->segment = (const logseg_head_t *)data;
+        return 0;
+    }
+    if ((size_t)size < sizeof(record) + sizeof(head) || (memcpy(&record, data, sizeof(record)), record.type != LOGBIN_HEAD) ||
+        (memcpy(&head, data + sizeof(record), sizeof(head)), head.magic != LOGBIN_MAGIC) || head.version != LOGBIN_VERSION) {
+        fprintf(stderr, "%s: not a binary log of this version\n", path);
+        free(data);
+        return -1;
+    }
+    return 0;
+}
+
+/* segments in the order they were written, other logs in the order given */
+static int input_compare(const void *a, const void *b)
+{
+    const input_t *x = (const input_t *)a;
+    const input_t *y = (const input_t *)b;
+    if (x->segment != NULL && y->segment != NULL && x->segment->sequence != y->segment->sequence) {
+        return x->segment->sequence < y->segment->sequence ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void decode(const char *path, const uint8_t *pos, const uint8_t *end)
+{
+    logbin_record_t record;
+    while ((size_t)(end - pos) >= sizeof(record)) {
+        memcpy(&record, pos, sizeof(record));
+        pos += sizeof(record);
+        if ((size_t)(end - pos) < record.size) {
+            fprintf(stderr, "%s: last record cut short\n", path);
+            return;
+        }
+        payload_t data = {pos, pos + record.size};
+        switch (record.type) {
+            case LOGBIN_DICT:
+                if (dict_add(&data) != 0) {
+                    fprintf(stderr, "%s: bad dictionary record\n", path);
+                }
+                break;
+            case LOGBIN_EVENT:
+                render_event(&data);
+                event_count++;
+                break;
+            case LOGBIN_TEXT:
+                fwrite(pos, record.size, 1, stdout);
+                break;
+            case LOGBIN_HEAD:  // the log was opened again
+                break;
+            default:
+                fprintf(stderr, "%s: unknown record type %u\n", path, record.type);
+                break;
+        }
+        pos += record.size;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <binary log | log segment>...\n", argv[0]);
+        return -1;
+    }
+    input_t *input = calloc(argc - 1, sizeof(input_t));
+    if (input == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    // a segment that was being started when the writer died has no head yet and is left out
+    int count = 0;
+    for (int i = 1; i < argc; i++) {
+        input[count].order = i;
+        count += input_load(argv[i], &input[count]) == 0;
+    }
+    qsort(input, count, sizeof(input_t), input_compare);
+
+    for (int i = 0; i < count; i++) {
+        const logseg_head_t *seg = input[i].segment;
+        if (seg == NULL) {
+            decode(input[i].path, input[i].data, input[i].data + input[i].size);
+        } else if (seg->flags & LOGSEG_FLAG_BINARY) {
+            decode(input[i].path, input[i].data + seg->head_size, input[i].data + seg->head_size + seg->used);
+        } else {
+            fwrite(input[i].data + seg->head_size, seg->used, 1, stdout);
+        }
+        free(input[i].data);
+    }
+    fprintf(stderr, "%llu events, %u call sites\n", (unsigned long long)event_count, site_count);
+    if (count != argc - 1) {
+        fprintf(stderr, "%d of %d files skipped\n", argc - 1 - count, argc - 1);
+    }
+
+    for (uint32_t i = 0; i < dict_size; i++) {
+        free(dict[i].level);
+        free(dict[i].tag);
+        free(dict[i].file);
+        free(dict[i].format);
+    }
+    free(dict);
+    free(input);
+    return 0;
+}
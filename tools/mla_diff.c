@@ -0,0 +1,217 @@
+/**
+ * @file mla_diff.c
+ * @author skull (skull.gu@gmail.com)
+ * @brief compares two snapshots written by MlaSnapshot and lists the sites whose outstanding allocations changed
+ * @version 0.1
+ * @date 2022-08-03
+ *
+ * @copyright Copyright (c) 2023 skull
+ *
+ * $ ./do.sh snapdiff
+ * $ ./mla_diff old.snap new.snap
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+typedef struct {
+    const uint8_t *base;
+    const snapshot_head_t *head;
+    size_t size;
+} snap_t;
+
+typedef struct {
+    const snapshot_site_t *site;  // from the new snapshot, or the old one if the site is gone
+    const snap_t *snap;
+    int64_t old_diff;
+    int64_t new_diff;
+    int64_t bytes;
+} growth_t;
+
+static const snap_t *sort_snap;  // qsort has no context argument
+
+/* the file is used in place, only the bounds of the tables are checked */
+static int snap_open(const char *path, snap_t *p_snap)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_head_t)) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap fail\n", path);
+        return -1;
+    }
+
+    const snapshot_head_t *head = (const snapshot_head_t *)base;
+    if (head->magic != SNAPSHOT_MAGIC || head->version != SNAPSHOT_VERSION ||
+        head->site_size < sizeof(snapshot_site_t) ||
+        head->head_size + (uint64_t)head->site_count * head->site_size > head->string_offset ||
+        (uint64_t)head->string_offset + head->string_size > (uint64_t)st.st_size) {
+        fprintf(stderr, "%s: not a snapshot of this version\n", path);
+        munmap(base, st.st_size);
+        return -1;
+    }
+    p_snap->base = (const uint8_t *)base;
+    p_snap->head = head;
+    p_snap->size = st.st_size;
+    return 0;
+}
+
+static const snapshot_site_t *snap_site(const snap_t *p_snap, uint32_t index)
+{
+    return (const snapshot_site_t *)(p_snap->base + p_snap->head->head_size + (size_t)index * p_snap->head->site_size);
+}
+
+static const char *snap_string(const snap_t *p_snap, uint32_t offset)
+{
+    if (offset >= p_snap->head->string_size) {
+        return "?";
+    }
+    return (const char *)p_snap->base + p_snap->head->string_offset + offset;
+}
+
+static int site_compare(const snap_t *p_a, const snapshot_site_t *p_x, const snap_t *p_b, const snapshot_site_t *p_y)
+{
+    int ret = strcmp(snap_string(p_a, p_x->file), snap_string(p_b, p_y->file));
+    if (ret != 0) {
+        return ret;
+    }
+    if (p_x->line != p_y->line) {
+        return p_x->line < p_y->line ? -1 : 1;
+    }
+    ret = strcmp(snap_string(p_a, p_x->func), snap_string(p_b, p_y->func));
+    if (ret != 0) {
+        return ret;
+    }
+    // call stacks are stored as module offsets, so the same stack matches across runs of one program
+    return strcmp(snap_string(p_a, p_x->stack), snap_string(p_b, p_y->stack));
+}
+
+static int index_compare(const void *a, const void *b)
+{
+    return site_compare(sort_snap, snap_site(sort_snap, *(const uint32_t *)a),
+        sort_snap, snap_site(sort_snap, *(const uint32_t *)b));
+}
+
+static int growth_compare(const void *a, const void *b)
+{
+    const growth_t *x = (const growth_t *)a;
+    const growth_t *y = (const growth_t *)b;
+    int64_t gx = x->new_diff - x->old_diff;
+    int64_t gy = y->new_diff - y->old_diff;
+    if (gx != gy) {
+        return gx > gy ? -1 : 1;
+    }
+    return x->bytes > y->bytes ? -1 : x->bytes < y->bytes;
+}
+
+/* binary search in the sorted index of the old snapshot */
+static int32_t old_find(const snap_t *p_old, const uint32_t *index, const snap_t *p_new, const snapshot_site_t *p_site)
+{
+    uint32_t low = 0, high = p_old->head->site_count;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        int ret = site_compare(p_old, snap_site(p_old, index[mid]), p_new, p_site);
+        if (ret == 0) {
+            return index[mid];
+        }
+        if (ret < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return -1;
+}
+
+static int64_t site_diff(const snapshot_site_t *p_site)
+{
+    return (int64_t)p_site->malloc_count - p_site->free_count;
+}
+
+int main(int argc, char *argv[])
+{
+    snap_t old_snap, new_snap;
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <old.snap> <new.snap>\n", argv[0]);
+        return -1;
+    }
+    if (snap_open(argv[1], &old_snap) != 0 || snap_open(argv[2], &new_snap) != 0) {
+        return -1;
+    }
+
+    uint32_t old_count = old_snap.head->site_count;
+    uint32_t new_count = new_snap.head->site_count;
+    uint32_t *index = malloc((old_count + 1) * sizeof(uint32_t));
+    uint8_t *matched = calloc(old_count + 1, 1);
+    growth_t *growth = malloc((old_count + new_count + 1) * sizeof(growth_t));
+    if (index == NULL || matched == NULL || growth == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < old_count; i++) {
+        index[i] = i;
+    }
+    sort_snap = &old_snap;
+    qsort(index, old_count, sizeof(uint32_t), index_compare);
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < new_count; i++) {
+        const snapshot_site_t *p_site = snap_site(&new_snap, i);
+        int32_t found = old_find(&old_snap, index, &new_snap, p_site);
+        const snapshot_site_t *p_old = found < 0 ? NULL : snap_site(&old_snap, found);
+        if (found >= 0) {
+            matched[found] = 1;
+        }
+        growth_t item = {p_site, &new_snap, p_old ? site_diff(p_old) : 0, site_diff(p_site),
+            (int64_t)p_site->live_bytes - (int64_t)(p_old ? p_old->live_bytes : 0)};
+        if (item.new_diff != item.old_diff || item.bytes != 0) {
+            growth[count++] = item;
+        }
+    }
+    // sites that only exist in the old snapshot, e.g. after MlaInit was called again
+    for (uint32_t i = 0; i < old_count; i++) {
+        const snapshot_site_t *p_site = snap_site(&old_snap, i);
+        if (!matched[i] && site_diff(p_site) != 0) {
+            growth_t item = {p_site, &old_snap, site_diff(p_site), 0, -(int64_t)p_site->live_bytes};
+            growth[count++] = item;
+        }
+    }
+    qsort(growth, count, sizeof(growth_t), growth_compare);
+
+    printf("%-64s%-16s%-16s%-16s%s\n", "Caller", "Old", "New", "Growth", "Bytes");
+    for (uint32_t i = 0; i < count; i++) {
+        char caller[64];
+        const growth_t *p_item = &growth[i];
+        const char *file = snap_string(p_item->snap, p_item->site->file);
+        const char *name = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+        snprintf(caller, sizeof(caller), "%s:%u %s", name, p_item->site->line, snap_string(p_item->snap, p_item->site->func));
+        printf("%-64s%-16lld%-16lld%-+16lld%+lld\n", caller, (long long)p_item->old_diff, (long long)p_item->new_diff,
+            (long long)(p_item->new_diff - p_item->old_diff), (long long)p_item->bytes);
+    }
+    printf("%u sites changed, %.3fs between snapshots\n", count,
+        ((double)new_snap.head->time_ms - (double)old_snap.head->time_ms) / 1000);
+    printf("live bytes %llu -> %llu, peak %llu -> %llu\n", (unsigned long long)old_snap.head->live_bytes,
+        (unsigned long long)new_snap.head->live_bytes, (unsigned long long)old_snap.head->peak_bytes,
+        (unsigned long long)new_snap.head->peak_bytes);
+
+    free(growth);
+    free(matched);
+    free(index);
+    munmap((void *)old_snap.base, old_snap.size);
+    munmap((void *)new_snap.base, new_snap.size);
+    return 0;
+}